@@ -0,0 +1,127 @@
+#ifndef GLOCAL_EXPLORATION_APP_BENCHMARK_UTILS_H_
+#define GLOCAL_EXPLORATION_APP_BENCHMARK_UTILS_H_
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <voxblox/core/layer.h>
+#include <voxblox/io/layer_io.h>
+
+#include "glocal_exploration/mapping/map_base.h"
+#include "glocal_exploration/state/region_of_interest.h"
+
+namespace glocal_exploration {
+
+// Utilities shared by the standalone (ROS-free) benchmarks.
+
+using TsdfLayer = voxblox::Layer<voxblox::TsdfVoxel>;
+using Clock = std::chrono::high_resolution_clock;
+
+inline double millisecondsSince(const Clock::time_point& t_start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - t_start)
+      .count();
+}
+
+// Runs fn num_repetitions times and returns the fastest duration in ms.
+template <typename Function>
+double timeBestOf(int num_repetitions, Function&& fn) {
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < num_repetitions; ++i) {
+    const auto t_start = Clock::now();
+    fn();
+    best = std::min(best, millisecondsSince(t_start));
+  }
+  return best;
+}
+
+class UnboundedRegion : public RegionOfInterest {
+ public:
+  bool contains(const Point& point) override { return true; }
+};
+
+// The TSDF layer of each submap is stored as '<id>.vxblx' in the directory.
+inline std::string submapLayerFile(const std::string& directory, int id) {
+  return directory + "/" + std::to_string(id) + ".vxblx";
+}
+
+struct SubmapPose {
+  int id;
+  Transformation T_M_S;
+};
+
+// Reads the submap poses from the lines 'id x y z qx qy qz qw' of
+// 'poses.txt' in the directory, where lines starting with '#' are comments.
+inline bool loadSubmapPoses(const std::string& directory,
+                            std::vector<SubmapPose>* submap_poses) {
+  CHECK_NOTNULL(submap_poses);
+  std::ifstream pose_file(directory + "/poses.txt");
+  if (!pose_file.is_open()) {
+    LOG(ERROR) << "Unable to open '" << directory << "/poses.txt'.";
+    return false;
+  }
+  std::string line;
+  while (std::getline(pose_file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    SubmapPose& submap_pose = submap_poses->emplace_back();
+    FloatingPoint x, y, z, qx, qy, qz, qw;
+    if (!(fields >> submap_pose.id >> x >> y >> z >> qx >> qy >> qz >> qw)) {
+      LOG(ERROR) << "Invalid pose line '" << line << "'.";
+      return false;
+    }
+    submap_pose.T_M_S = Transformation(
+        voxblox::Quaternion(qw, qx, qy, qz).normalized(), Point(x, y, z));
+  }
+  if (submap_poses->empty()) {
+    LOG(ERROR) << "No submaps found in '" << directory << "'.";
+    return false;
+  }
+  return true;
+}
+
+// Loads the poses and TSDF layers of the submaps of a directory. All submaps
+// need to have the same voxel size.
+inline bool loadSubmaps(const std::string& directory,
+                        std::vector<MapBase::SubmapData>* submaps) {
+  CHECK_NOTNULL(submaps);
+  std::vector<SubmapPose> submap_poses;
+  if (!loadSubmapPoses(directory, &submap_poses)) {
+    return false;
+  }
+  for (const SubmapPose& submap_pose : submap_poses) {
+    MapBase::SubmapData data;
+    data.id = submap_pose.id;
+    data.T_M_S = submap_pose.T_M_S;
+    std::shared_ptr<TsdfLayer> tsdf_layer;
+    const std::string layer_file = submapLayerFile(directory, data.id);
+    if (!voxblox::io::LoadLayer<voxblox::TsdfVoxel>(layer_file,
+                                                    &tsdf_layer)) {
+      LOG(ERROR) << "Unable to load submap '" << layer_file << "'.";
+      return false;
+    }
+    data.tsdf_layer = std::move(tsdf_layer);
+    submaps->push_back(std::move(data));
+  }
+  for (const MapBase::SubmapData& data : *submaps) {
+    if (data.tsdf_layer->voxel_size() !=
+        submaps->front().tsdf_layer->voxel_size()) {
+      LOG(ERROR) << "All submaps need to have the same voxel size.";
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace glocal_exploration
+
+#endif  // GLOCAL_EXPLORATION_APP_BENCHMARK_UTILS_H_
@@ -0,0 +1,492 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "glocal_exploration/mapping/map_base.h"
+#include "glocal_exploration/planning/global/submap_frontier_evaluator.h"
+#include "glocal_exploration/state/communicator.h"
+
+#include "benchmark_utils.h"
+
+DEFINE_string(submap_directory, "",
+              "Directory containing the submap TSDF layers as '<id>.vxblx' "
+              "and their poses as lines 'id x y z qx qy qz qw' in "
+              "'poses.txt'.");
+DEFINE_int32(num_repetitions, 3,
+             "Number of times each stage is timed, the fastest run is "
+             "reported.");
+DEFINE_int32(num_threads, 4, "Threads used by the frontier evaluator.");
+DEFINE_bool(check_results, true,
+            "Compare the optimized implementations against the reference "
+            "implementations.");
+
+namespace glocal_exploration {
+
+// Standalone (ROS-free) benchmark and regression harness for the frontier
+// extraction of the SubmapFrontierEvaluator on saved submaps.
+
+/**
+ * Minimal global map over a fixed set of submaps. Only the global map queries
+ * used by the frontier evaluator are supported.
+ */
+class OfflineSubmapMap : public MapBase {
+ public:
+  explicit OfflineSubmapMap(std::vector<SubmapData> submaps)
+      : MapBase(nullptr), submaps_(std::move(submaps)) {
+    for (const SubmapData& submap : submaps_) {
+      T_S_M_.push_back(submap.T_M_S.inverse());
+    }
+    num_visible_submaps_ = submaps_.size();
+  }
+
+  // Only the first num_submaps submaps are part of the map, s.t. a growing
+  // map can be simulated.
+  void setNumVisibleSubmaps(size_t num_submaps) {
+    num_visible_submaps_ = std::min(num_submaps, submaps_.size());
+  }
+
+  /* General and Accessors */
+  FloatingPoint getVoxelSize() const override {
+    return submaps_.front().tsdf_layer->voxel_size();
+  }
+  FloatingPoint getTraversabilityRadius() const override { return 0.f; }
+  std::vector<WayPoint> getPoseHistory() const override { return {}; }
+
+  /* Local planner */
+  bool isTraversableInActiveSubmap(const Point& position,
+                                   const FloatingPoint traversability_radius,
+                                   const bool optimistic) const override {
+    return false;
+  }
+  bool isLineTraversableInActiveSubmap(
+      const Point& start_point, const Point& end_point,
+      const FloatingPoint traversability_radius, Point* last_traversable_point,
+      const bool optimistic) override {
+    return false;
+  }
+  bool lineIntersectsSurfaceInActiveSubmap(const Point& start_point,
+                                           const Point& end_point) override {
+    return true;
+  }
+  bool getDistanceInActiveSubmap(const Point& position,
+                                 FloatingPoint* distance) const override {
+    return false;
+  }
+  bool getDistanceAndGradientInActiveSubmap(const Point& position,
+                                            FloatingPoint* distance,
+                                            Point* gradient) const override {
+    return false;
+  }
+  Point getVoxelCenterInLocalArea(const Point& position) const override {
+    return position;
+  }
+  VoxelState getVoxelStateInLocalArea(const Point& position) override {
+    return VoxelState::kUnknown;
+  }
+
+  /* Global planner */
+  bool isObservedInGlobalMap(const Point& position) override {
+    return !getSubmapIdsAtPosition(position).empty();
+  }
+  bool isTraversableInGlobalMap(
+      const Point& position,
+      const FloatingPoint traversability_radius) override {
+    return false;
+  }
+  bool isLineTraversableInGlobalMap(const Point& start_point,
+                                    const Point& end_point,
+                                    const FloatingPoint traversability_radius,
+                                    Point* last_traversable_point) override {
+    return false;
+  }
+  bool lineIntersectsSurfaceInGlobalMap(const Point& start_point,
+                                        const Point& end_point) override {
+    return true;
+  }
+  bool getDistanceInGlobalMap(const Point& position,
+                              FloatingPoint* distance) override {
+    return false;
+  }
+
+  // Returns the submaps that observed the position.
+  std::vector<SubmapId> getSubmapIdsAtPosition(
+      const Point& position) const override {
+    std::vector<SubmapId> result;
+    for (size_t i = 0u; i < num_visible_submaps_; ++i) {
+      const voxblox::TsdfVoxel* voxel =
+          submaps_[i].tsdf_layer->getVoxelPtrByCoordinates(T_S_M_[i] *
+                                                           position);
+      if (voxel && voxel->weight > 1e-6) {
+        result.push_back(submaps_[i].id);
+      }
+    }
+    return result;
+  }
+  std::vector<SubmapData> getAllSubmapData() override {
+    return std::vector<SubmapData>(submaps_.begin(),
+                                   submaps_.begin() + num_visible_submaps_);
+  }
+
+ private:
+  const std::vector<SubmapData> submaps_;
+  std::vector<Transformation> T_S_M_;
+  size_t num_visible_submaps_;
+};
+
+/**
+ * Exposes the stages of the frontier evaluator, s.t. they can be timed and
+ * compared individually.
+ */
+class FrontierBenchmarkEvaluator : public SubmapFrontierEvaluator {
+ public:
+  using SubmapFrontierEvaluator::SubmapFrontierEvaluator;
+  void executePlanningIteration() override {}
+
+  using SubmapFrontierEvaluator::clusterFrontierPoints;
+  using SubmapFrontierEvaluator::indexFromPoint;
+  using SubmapFrontierEvaluator::kMaxVoxelsPerSideForSweep;
+  using SubmapFrontierEvaluator::searchFrontierCandidates;
+  using SubmapFrontierEvaluator::sweepFrontierCandidates;
+  using SubmapFrontierEvaluator::voxelState;
+
+  // Reference: every unknown voxel adjacent to any free voxel, checked voxel
+  // by voxel. This is the definition the sweep implements.
+  IndexSet referenceFrontierCandidates(const TsdfLayer& layer) const {
+    const int voxels_per_side = layer.voxels_per_side();
+    voxblox::BlockIndexList blocks;
+    layer.getAllAllocatedBlocks(&blocks);
+    IndexSet result;
+    for (const voxblox::BlockIndex& block_index : blocks) {
+      for (int x = 0; x < voxels_per_side; ++x) {
+        for (int y = 0; y < voxels_per_side; ++y) {
+          for (int z = 0; z < voxels_per_side; ++z) {
+            const Index index =
+                voxblox::getGlobalVoxelIndexFromBlockAndVoxelIndex(
+                    block_index, voxblox::VoxelIndex(x, y, z),
+                    voxels_per_side);
+            if (voxelState(index, layer) != MapBase::VoxelState::kFree) {
+              continue;
+            }
+            for (const Index& offset : kNeighborOffsets) {
+              if (voxelState(index + offset, layer) ==
+                  MapBase::VoxelState::kUnknown) {
+                result.insert(index + offset);
+              }
+            }
+          }
+        }
+      }
+    }
+    return result;
+  }
+
+  // Reference: breadth-first flood fill over the 26-neighborhood.
+  std::vector<std::vector<Index>> referenceClusterFrontierPoints(
+      const IndexSet& points) const {
+    std::vector<std::vector<Index>> clusters;
+    IndexSet closed_list;
+    for (const Index& seed : points) {
+      if (!closed_list.insert(seed).second) {
+        continue;
+      }
+      std::vector<Index>& cluster = clusters.emplace_back();
+      std::queue<Index> open_queue;
+      open_queue.push(seed);
+      while (!open_queue.empty()) {
+        const Index current = open_queue.front();
+        open_queue.pop();
+        cluster.push_back(current);
+        for (const Index& offset : kNeighborOffsets) {
+          const Index neighbor = current + offset;
+          if (points.find(neighbor) != points.end() &&
+              closed_list.insert(neighbor).second) {
+            open_queue.push(neighbor);
+          }
+        }
+      }
+    }
+    return clusters;
+  }
+};
+
+using Index = SubmapFrontierEvaluator::Index;
+using IndexSet = SubmapFrontierEvaluator::IndexSet;
+
+bool indexLess(const Index& a, const Index& b) {
+  return std::lexicographical_compare(a.data(), a.data() + 3, b.data(),
+                                      b.data() + 3);
+}
+
+// Order-independent representation of a set of clusters.
+std::vector<std::vector<Index>> canonicalClusters(
+    std::vector<std::vector<Index>> clusters) {
+  for (std::vector<Index>& cluster : clusters) {
+    std::sort(cluster.begin(), cluster.end(), indexLess);
+  }
+  std::sort(clusters.begin(), clusters.end(),
+            [](const std::vector<Index>& a, const std::vector<Index>& b) {
+              return std::lexicographical_compare(a.begin(), a.end(),
+                                                  b.begin(), b.end(),
+                                                  indexLess);
+            });
+  return clusters;
+}
+
+std::vector<std::vector<Index>> frontiersToIndices(
+    const std::vector<std::vector<Point>>& frontiers,
+    FloatingPoint voxel_size) {
+  std::vector<std::vector<Index>> result;
+  for (const std::vector<Point>& frontier : frontiers) {
+    std::vector<Index>& indices = result.emplace_back();
+    for (const Point& point : frontier) {
+      indices.push_back(
+          voxblox::getGridIndexFromPoint<Index>(point, 1.f / voxel_size));
+    }
+  }
+  return result;
+}
+
+IndexSet pointsToIndexSet(const std::vector<Point>& points,
+                          FloatingPoint voxel_size) {
+  IndexSet result;
+  for (const Point& point : points) {
+    result.insert(
+        voxblox::getGridIndexFromPoint<Index>(point, 1.f / voxel_size));
+  }
+  return result;
+}
+
+// Number of elements of 'set' that are not in 'other'.
+size_t numMissingIn(const IndexSet& set, const IndexSet& other) {
+  size_t result = 0u;
+  for (const Index& index : set) {
+    if (other.find(index) == other.end()) {
+      result++;
+    }
+  }
+  return result;
+}
+
+// Peak resident memory of the process in kB, 0 if unavailable.
+size_t peakResidentMemoryKb() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoul(line.substr(6));
+    }
+  }
+  return 0u;
+}
+
+void printStage(const std::string& name, double milliseconds,
+                size_t num_items = 0u) {
+  std::cout << "  " << std::left << std::setw(34) << name << std::right
+            << std::setw(10) << std::fixed << std::setprecision(2)
+            << milliseconds << " ms";
+  if (num_items > 0u && milliseconds > 0.0) {
+    std::cout << std::setw(14) << std::setprecision(0)
+              << num_items / milliseconds * 1000.0 << " candidates/s";
+  }
+  std::cout << std::endl;
+}
+
+int runBenchmark() {
+  std::vector<MapBase::SubmapData> submaps;
+  if (!loadSubmaps(FLAGS_submap_directory, &submaps)) {
+    return 1;
+  }
+  const FloatingPoint voxel_size = submaps.front().tsdf_layer->voxel_size();
+  const int num_repetitions = std::max(FLAGS_num_repetitions, 1);
+  size_t num_allocated_blocks = 0u;
+  for (const MapBase::SubmapData& data : submaps) {
+    num_allocated_blocks += data.tsdf_layer->getNumberOfAllocatedBlocks();
+  }
+  std::cout << "Loaded " << submaps.size() << " submaps ("
+            << num_allocated_blocks << " blocks, voxel size " << voxel_size
+            << "m, " << submaps.front().tsdf_layer->voxels_per_side()
+            << " voxels per side)." << std::endl;
+
+  // Setup.
+  auto communicator = std::make_shared<Communicator>();
+  auto map = std::make_shared<OfflineSubmapMap>(submaps);
+  communicator->setupMap(map);
+  communicator->setupRegionOfInterest(std::make_shared<UnboundedRegion>());
+  SubmapFrontierEvaluator::Config config;
+  config.verbosity = 0;
+  config.num_threads = FLAGS_num_threads;
+  FrontierBenchmarkEvaluator evaluator(config, communicator);
+  bool success = true;
+
+  // Stage 1: Candidate extraction in each submap.
+  std::cout << "Candidate extraction:" << std::endl;
+  double sweep_ms = 0.0;
+  double search_ms = 0.0;
+  double reference_ms = 0.0;
+  size_t num_candidates = 0u;
+  size_t num_mismatched_submaps = 0u;
+  size_t num_unreached_candidates = 0u;
+  std::vector<std::pair<int, std::vector<Point>>> all_candidates;
+  for (const MapBase::SubmapData& data : submaps) {
+    const TsdfLayer& layer = *data.tsdf_layer;
+    const bool use_sweep =
+        layer.voxels_per_side() <=
+        FrontierBenchmarkEvaluator::kMaxVoxelsPerSideForSweep;
+    std::vector<Point> sweep_result;
+    std::vector<Point> search_result;
+    if (use_sweep) {
+      sweep_ms += timeBestOf(num_repetitions, [&] {
+        sweep_result = evaluator.sweepFrontierCandidates(layer);
+      });
+    }
+    search_ms += timeBestOf(num_repetitions, [&] {
+      search_result =
+          evaluator.searchFrontierCandidates(layer, Point(0.f, 0.f, 0.f));
+    });
+    if (!use_sweep) {
+      sweep_result = search_result;
+    }
+    num_candidates += sweep_result.size();
+
+    if (FLAGS_check_results) {
+      IndexSet reference;
+      reference_ms += timeBestOf(
+          1, [&] { reference = evaluator.referenceFrontierCandidates(layer); });
+      // The sweep has to match the reference exactly. The search only finds
+      // the candidates next to the free space connected to the submap origin.
+      const IndexSet sweep = pointsToIndexSet(sweep_result, voxel_size);
+      const IndexSet search = pointsToIndexSet(search_result, voxel_size);
+      if (use_sweep && (sweep.size() != reference.size() ||
+           numMissingIn(sweep, reference) != 0u)) {
+        LOG(ERROR) << "Sweep candidates of submap " << data.id
+                   << " differ from the reference: " << sweep.size()
+                   << " vs " << reference.size() << " candidates, "
+                   << numMissingIn(reference, sweep) << " missing, "
+                   << numMissingIn(sweep, reference) << " extra.";
+        num_mismatched_submaps++;
+      }
+      if (numMissingIn(search, reference) != 0u) {
+        LOG(ERROR) << "Search found " << numMissingIn(search, reference)
+                   << " candidates of submap " << data.id
+                   << " that are not in the reference.";
+        num_mismatched_submaps++;
+      }
+      num_unreached_candidates += numMissingIn(reference, search);
+    }
+    all_candidates.emplace_back(data.id, std::move(sweep_result));
+  }
+  printStage("sweep", sweep_ms, num_candidates);
+  printStage("search (flood fill)", search_ms, num_candidates);
+  if (FLAGS_check_results) {
+    printStage("reference", reference_ms, num_candidates);
+    std::cout << "  " << num_candidates << " candidates, "
+              << num_unreached_candidates
+              << " not connected to the submap origins, "
+              << num_mismatched_submaps << " mismatched submaps." << std::endl;
+    success &= num_mismatched_submaps == 0u;
+  }
+
+  // Stage 2: Clustering of all candidates in mission frame.
+  std::cout << "Clustering:" << std::endl;
+  IndexSet global_candidates;
+  for (size_t i = 0u; i < submaps.size(); ++i) {
+    for (const Point& candidate_S : all_candidates[i].second) {
+      global_candidates.insert(evaluator.indexFromPoint(
+          submaps[i].T_M_S * candidate_S, 1.f / voxel_size));
+    }
+  }
+  std::vector<std::vector<Index>> clusters;
+  const double union_find_ms = timeBestOf(num_repetitions, [&] {
+    clusters = evaluator.clusterFrontierPoints(global_candidates);
+  });
+  printStage("union-find", union_find_ms, global_candidates.size());
+  if (FLAGS_check_results) {
+    std::vector<std::vector<Index>> reference_clusters;
+    const double reference_cluster_ms = timeBestOf(1, [&] {
+      reference_clusters =
+          evaluator.referenceClusterFrontierPoints(global_candidates);
+    });
+    printStage("reference", reference_cluster_ms, global_candidates.size());
+    const bool clusters_match = canonicalClusters(clusters) ==
+                                canonicalClusters(reference_clusters);
+    std::cout << "  " << global_candidates.size() << " points, "
+              << clusters.size() << " clusters, "
+              << (clusters_match ? "identical" : "DIFFERENT")
+              << " to the reference." << std::endl;
+    success &= clusters_match;
+  }
+
+  // Stage 3: Global frontier updates. The submaps are added one at a time as
+  // during a mission, and the final result is compared to a single update.
+  std::cout << "Global frontier update:" << std::endl;
+  const auto t_incremental = Clock::now();
+  for (size_t num_submaps = 1u; num_submaps <= submaps.size(); ++num_submaps) {
+    map->setNumVisibleSubmaps(num_submaps);
+    evaluator.updateFrontiers(map->getAllSubmapData());
+  }
+  printStage("incremental (" + std::to_string(submaps.size()) + " updates)",
+             millisecondsSince(t_incremental), num_candidates);
+  size_t candidate_memory = 0u;
+  for (const auto& id_candidates_pair : evaluator.getFrontierCandidates()) {
+    candidate_memory += id_candidates_pair.second.getMemorySize();
+  }
+  if (FLAGS_check_results) {
+    FrontierBenchmarkEvaluator batch_evaluator(config, communicator);
+    const auto t_batch = Clock::now();
+    batch_evaluator.updateFrontiers(map->getAllSubmapData());
+    printStage("single update", millisecondsSince(t_batch), num_candidates);
+    const bool frontiers_match =
+        canonicalClusters(frontiersToIndices(evaluator.getActiveFrontiers(),
+                                             voxel_size)) ==
+            canonicalClusters(frontiersToIndices(
+                batch_evaluator.getActiveFrontiers(), voxel_size)) &&
+        pointsToIndexSet(evaluator.getInactiveFrontiers(), voxel_size) ==
+            pointsToIndexSet(batch_evaluator.getInactiveFrontiers(),
+                             voxel_size);
+    std::cout << "  " << evaluator.getActiveFrontiers().size()
+              << " active frontiers, "
+              << evaluator.getInactiveFrontiers().size()
+              << " inactive points, incremental and single update are "
+              << (frontiers_match ? "identical" : "DIFFERENT") << "."
+              << std::endl;
+    success &= frontiers_match;
+  }
+
+  // Memory.
+  std::cout << "Memory:" << std::endl
+            << "  candidates " << candidate_memory / 1024 << " kB ("
+            << num_candidates * sizeof(Point) / 1024 << " kB as points)"
+            << std::endl
+            << "  peak resident " << peakResidentMemoryKb() << " kB"
+            << std::endl;
+
+  std::cout << (success ? "All checks passed." : "Checks FAILED.")
+            << std::endl;
+  return success ? 0 : 1;
+}
+
+}  // namespace glocal_exploration
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  google::SetUsageMessage(
+      "Benchmarks the frontier extraction on saved submaps.\nUsage: "
+      "frontier_benchmark --submap_directory=<path>");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  if (FLAGS_submap_directory.empty()) {
+    google::ShowUsageWithFlags(argv[0]);
+    return 1;
+  }
+  return glocal_exploration::runBenchmark();
+}
@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cblox/core/tsdf_esdf_submap.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <voxblox/Layer.pb.h>
+#include <voxblox/io/layer_io.h>
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "glocal_exploration/mapping/map_base.h"
+#include "glocal_exploration/planning/global/skeleton/skeleton_a_star.h"
+#include "glocal_exploration/state/communicator.h"
+
+#include "benchmark_utils.h"
+
+DEFINE_string(submap_directory, "",
+              "Directory containing the submap TSDF layers as '<id>.vxblx' "
+              "and their poses as lines 'id x y z qx qy qz qw' in "
+              "'poses.txt'.");
+DEFINE_string(queries_file, "",
+              "File containing the start and goal points to plan between as "
+              "lines 'sx sy sz gx gy gz' in mission frame.");
+DEFINE_int32(num_repetitions, 3,
+             "Number of times each query is timed, the fastest run is "
+             "reported.");
+DEFINE_int32(num_threads, 4, "Threads used to generate the skeletons.");
+DEFINE_double(traversability_radius, 1.1,
+              "Traversability radius of the skeletons and the planner in m.");
+DEFINE_bool(use_hierarchical_search, true,
+            "Search the portal layer before refining the path.");
+DEFINE_bool(cache_edge_traversability, true,
+            "Reuse the skeleton edge traversabilities across searches.");
+
+namespace glocal_exploration {
+
+// Standalone (ROS-free) benchmark of the SkeletonAStar global planner on
+// saved submaps and recorded start and goal points.
+
+/**
+ * Global map over a fixed set of submaps, implementing the queries of the
+ * skeleton planner like the VoxgraphMap does. Since there is no robot, the
+ * active submap queries are answered by the global map. The number of
+ * queries is counted to compare the planner variants.
+ * NOTE: Only queried from the planning thread.
+ */
+class OfflineSubmapMap : public MapBase {
+ public:
+  struct QueryCounts {
+    size_t num_point_queries = 0u;
+    size_t num_line_queries = 0u;
+    size_t num_submap_id_queries = 0u;
+    size_t total() const {
+      return num_point_queries + num_line_queries + num_submap_id_queries;
+    }
+  };
+
+  explicit OfflineSubmapMap(std::vector<cblox::TsdfEsdfSubmap::Ptr> submaps)
+      : MapBase(nullptr), submaps_(std::move(submaps)) {
+    for (const cblox::TsdfEsdfSubmap::Ptr& submap : submaps_) {
+      T_S_M_.push_back(submap->getPose().inverse());
+    }
+  }
+
+  const QueryCounts& getQueryCounts() const { return query_counts_; }
+  void resetQueryCounts() { query_counts_ = QueryCounts(); }
+
+  /* General and Accessors */
+  FloatingPoint getVoxelSize() const override {
+    return submaps_.front()->getEsdfMap().voxel_size();
+  }
+  FloatingPoint getTraversabilityRadius() const override {
+    return FLAGS_traversability_radius;
+  }
+  std::vector<WayPoint> getPoseHistory() const override { return {}; }
+
+  /* Local planner */
+  bool isTraversableInActiveSubmap(const Point& position,
+                                   const FloatingPoint traversability_radius,
+                                   const bool optimistic) const override {
+    query_counts_.num_point_queries++;
+    return isTraversable(position, traversability_radius);
+  }
+  bool isLineTraversableInActiveSubmap(
+      const Point& start_point, const Point& end_point,
+      const FloatingPoint traversability_radius, Point* last_traversable_point,
+      const bool optimistic) override {
+    return isLineTraversableInGlobalMap(start_point, end_point,
+                                        traversability_radius,
+                                        last_traversable_point);
+  }
+  bool lineIntersectsSurfaceInActiveSubmap(const Point& start_point,
+                                           const Point& end_point) override {
+    return true;
+  }
+  bool getDistanceInActiveSubmap(const Point& position,
+                                 FloatingPoint* distance) const override {
+    return getDistance(position, distance);
+  }
+  bool getDistanceAndGradientInActiveSubmap(const Point& position,
+                                            FloatingPoint* distance,
+                                            Point* gradient) const override {
+    return false;
+  }
+  Point getVoxelCenterInLocalArea(const Point& position) const override {
+    return position;
+  }
+  VoxelState getVoxelStateInLocalArea(const Point& position) override {
+    return VoxelState::kUnknown;
+  }
+
+  /* Global planner */
+  bool isObservedInGlobalMap(const Point& position) override {
+    return !getSubmapIdsAtPosition(position).empty();
+  }
+  bool isTraversableInGlobalMap(
+      const Point& position,
+      const FloatingPoint traversability_radius) override {
+    query_counts_.num_point_queries++;
+    return isTraversable(position, traversability_radius);
+  }
+  bool isLineTraversableInGlobalMap(const Point& start_point,
+                                    const Point& end_point,
+                                    const FloatingPoint traversability_radius,
+                                    Point* last_traversable_point) override {
+    query_counts_.num_line_queries++;
+    if (last_traversable_point) {
+      *last_traversable_point = start_point;
+    }
+    const FloatingPoint voxel_size = getVoxelSize();
+    const FloatingPoint line_length = (end_point - start_point).norm();
+    if (line_length <= voxblox::kFloatEpsilon) {
+      return isTraversable(start_point, traversability_radius);
+    }
+
+    // Step along the line as far as the ESDF allows.
+    const Point line_direction = (end_point - start_point) / line_length;
+    Point current_position = start_point;
+    FloatingPoint traveled_distance = 0.f;
+    while (traveled_distance <= line_length) {
+      FloatingPoint esdf_distance = 0.f;
+      if (!getDistance(current_position, &esdf_distance) ||
+          esdf_distance < traversability_radius) {
+        return false;
+      }
+      if (last_traversable_point) {
+        *last_traversable_point = current_position;
+      }
+      const FloatingPoint step_size =
+          std::max(voxel_size, esdf_distance - traversability_radius);
+      current_position += step_size * line_direction;
+      traveled_distance += step_size;
+    }
+
+    if (!isTraversable(end_point, traversability_radius)) {
+      return false;
+    }
+    if (last_traversable_point) {
+      *last_traversable_point = end_point;
+    }
+    return true;
+  }
+  bool lineIntersectsSurfaceInGlobalMap(const Point& start_point,
+                                        const Point& end_point) override {
+    return true;
+  }
+  bool getDistanceInGlobalMap(const Point& position,
+                              FloatingPoint* distance) override {
+    query_counts_.num_point_queries++;
+    return getDistance(position, distance);
+  }
+
+  // Returns the submaps whose ESDF observed the position.
+  std::vector<SubmapId> getSubmapIdsAtPosition(
+      const Point& position) const override {
+    query_counts_.num_submap_id_queries++;
+    std::vector<SubmapId> result;
+    for (size_t i = 0u; i < submaps_.size(); ++i) {
+      const voxblox::EsdfVoxel* voxel =
+          submaps_[i]->getEsdfMap().getEsdfLayer().getVoxelPtrByCoordinates(
+              T_S_M_[i] * position);
+      if (voxel && voxel->observed) {
+        result.push_back(submaps_[i]->getID());
+      }
+    }
+    return result;
+  }
+  std::vector<SubmapData> getAllSubmapData() override {
+    std::vector<SubmapData> result;
+    for (const cblox::TsdfEsdfSubmap::Ptr& submap : submaps_) {
+      SubmapData& data = result.emplace_back();
+      data.id = submap->getID();
+      data.T_M_S = submap->getPose();
+      data.tsdf_layer = std::make_shared<TsdfLayer>(
+          submap->getTsdfMap().getTsdfLayer());
+    }
+    return result;
+  }
+
+ private:
+  const std::vector<cblox::TsdfEsdfSubmap::Ptr> submaps_;
+  std::vector<Transformation> T_S_M_;
+  mutable QueryCounts query_counts_;
+
+  // Smallest ESDF distance of all submaps that observed the position.
+  bool getDistance(const Point& position, FloatingPoint* distance) const {
+    CHECK_NOTNULL(distance);
+    bool is_observed = false;
+    *distance = std::numeric_limits<FloatingPoint>::max();
+    for (size_t i = 0u; i < submaps_.size(); ++i) {
+      double submap_distance = 0.0;
+      if (submaps_[i]->getEsdfMap().getDistanceAtPosition(
+              (T_S_M_[i] * position).cast<double>(), &submap_distance)) {
+        *distance =
+            std::min(*distance, static_cast<FloatingPoint>(submap_distance));
+        is_observed = true;
+      }
+    }
+    return is_observed;
+  }
+  bool isTraversable(const Point& position,
+                     const FloatingPoint traversability_radius) const {
+    FloatingPoint distance = 0.f;
+    return getDistance(position, &distance) &&
+           traversability_radius <= distance;
+  }
+};
+
+/**
+ * Exposes the skeleton generation, s.t. the planning can be timed on the
+ * complete set of skeletons.
+ */
+class SkeletonBenchmarkAStar : public SkeletonAStar {
+ public:
+  using SkeletonAStar::SkeletonAStar;
+
+  void waitForPendingSubmaps() {
+    skeleton_submap_collection_.waitForPendingSubmaps();
+  }
+};
+
+struct Query {
+  Point start_point;
+  Point goal_point;
+};
+
+// Per query results of the timed functions, best of all repetitions.
+struct QueryResult {
+  bool found_path = false;
+  size_t num_start_vertices = 0u;
+  size_t num_goal_vertices = 0u;
+  SkeletonAStar::SearchStatistics search_statistics;
+  size_t num_map_queries = 0u;
+  double plan_path_ms = std::numeric_limits<double>::max();
+  double closest_vertices_ms = std::numeric_limits<double>::max();
+  double path_between_vertices_ms = std::numeric_limits<double>::max();
+};
+
+// Reads the layer header, which holds the voxel size and the number of voxels
+// per side, without loading the blocks.
+bool loadLayerHeader(const std::string& file_name,
+                     voxblox::LayerProto* layer_proto) {
+  std::fstream layer_file(file_name, std::fstream::in | std::fstream::binary);
+  if (!layer_file.is_open()) {
+    return false;
+  }
+  uint32_t num_protos = 0u;
+  uint64_t byte_offset = 0u;
+  return voxblox::utils::readProtoMsgCountToStream(&layer_file, &num_protos,
+                                                   &byte_offset) &&
+         voxblox::utils::readProtoMsgFromStream(&layer_file, layer_proto,
+                                                &byte_offset);
+}
+
+bool loadEsdfSubmaps(const std::string& directory,
+                     std::vector<cblox::TsdfEsdfSubmap::Ptr>* submaps) {
+  std::vector<SubmapPose> submap_poses;
+  if (!loadSubmapPoses(directory, &submap_poses)) {
+    return false;
+  }
+  for (const SubmapPose& submap_pose : submap_poses) {
+    // Only read the layer's header for its resolution, then load the blocks
+    // directly into the submap and generate its ESDF.
+    const std::string layer_file = submapLayerFile(directory, submap_pose.id);
+    voxblox::LayerProto layer_proto;
+    if (!loadLayerHeader(layer_file, &layer_proto)) {
+      LOG(ERROR) << "Unable to read the header of '" << layer_file << "'.";
+      return false;
+    }
+    cblox::TsdfEsdfSubmap::Config config;
+    config.tsdf_voxel_size = layer_proto.voxel_size();
+    config.tsdf_voxels_per_side = layer_proto.voxels_per_side();
+    config.esdf_voxel_size = layer_proto.voxel_size();
+    config.esdf_voxels_per_side = layer_proto.voxels_per_side();
+    auto submap = std::make_shared<cblox::TsdfEsdfSubmap>(
+        submap_pose.T_M_S, submap_pose.id, config);
+    if (!voxblox::io::LoadBlocksFromFile<voxblox::TsdfVoxel>(
+            layer_file, TsdfLayer::BlockMergingStrategy::kReplace,
+            submap->getTsdfMapPtr()->getTsdfLayerPtr())) {
+      LOG(ERROR) << "Unable to load the blocks of '" << layer_file << "'.";
+      return false;
+    }
+    submap->generateEsdf();
+    submaps->push_back(std::move(submap));
+  }
+  return true;
+}
+
+bool loadQueries(const std::string& file_name, std::vector<Query>* queries) {
+  std::ifstream query_file(file_name);
+  if (!query_file.is_open()) {
+    LOG(ERROR) << "Unable to open '" << file_name << "'.";
+    return false;
+  }
+  std::string line;
+  while (std::getline(query_file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    Query& query = queries->emplace_back();
+    if (!(fields >> query.start_point.x() >> query.start_point.y() >>
+          query.start_point.z() >> query.goal_point.x() >>
+          query.goal_point.y() >> query.goal_point.z())) {
+      LOG(ERROR) << "Invalid query line '" << line << "'.";
+      return false;
+    }
+  }
+  if (queries->empty()) {
+    LOG(ERROR) << "No queries found in '" << file_name << "'.";
+    return false;
+  }
+  return true;
+}
+
+QueryResult runQuery(const Query& query, int num_repetitions,
+                     SkeletonBenchmarkAStar* planner, OfflineSubmapMap* map) {
+  QueryResult result;
+  const FloatingPoint traversability_radius =
+      planner->getTraversabilityRadius();
+  const SkeletonAStar::VertexTraversabilityFunction traversability_function =
+      [map, traversability_radius](const Point& point, const GlobalVertexId&,
+                                   const Point& vertex_point) {
+        return map->isLineTraversableInGlobalMap(point, vertex_point,
+                                                 traversability_radius,
+                                                 nullptr);
+      };
+
+  // The stages individually.
+  std::vector<GlobalVertexId> start_vertices;
+  std::vector<GlobalVertexId> goal_vertices;
+  result.closest_vertices_ms = timeBestOf(num_repetitions, [&] {
+    start_vertices = planner->searchClosestReachableSkeletonVertices(
+        query.start_point,
+        planner->getConfig().max_num_start_vertex_candidates,
+        traversability_function);
+    goal_vertices = planner->searchClosestReachableSkeletonVertices(
+        query.goal_point, planner->getConfig().max_num_end_vertex_candidates,
+        traversability_function);
+  });
+  result.num_start_vertices = start_vertices.size();
+  result.num_goal_vertices = goal_vertices.size();
+  if (start_vertices.empty() || goal_vertices.empty()) {
+    result.path_between_vertices_ms = 0.0;
+  } else {
+    // The statistics are those of the first search of this query, before the
+    // repetitions could reuse its cached edge traversabilities.
+    map->resetQueryCounts();
+    for (int i = 0; i < num_repetitions; ++i) {
+      std::vector<GlobalVertexId> vertex_path;
+      const auto t_start = Clock::now();
+      result.found_path = planner->getPathBetweenVertices(
+          start_vertices, goal_vertices, query.start_point, query.goal_point,
+          &vertex_path);
+      result.path_between_vertices_ms = std::min(
+          result.path_between_vertices_ms, millisecondsSince(t_start));
+      if (i == 0) {
+        result.search_statistics = planner->getLastSearchStatistics();
+        result.num_map_queries = map->getQueryCounts().total();
+      }
+    }
+  }
+
+  // The full pipeline, including the start and goal point checks.
+  result.plan_path_ms = timeBestOf(num_repetitions, [&] {
+    std::vector<RelativeWayPoint> way_points;
+    planner->planPath(query.start_point, query.goal_point, &way_points);
+  });
+  return result;
+}
+
+int runBenchmark() {
+  std::vector<cblox::TsdfEsdfSubmap::Ptr> submaps;
+  std::vector<Query> queries;
+  const auto t_load = Clock::now();
+  if (!loadEsdfSubmaps(FLAGS_submap_directory, &submaps) ||
+      !loadQueries(FLAGS_queries_file, &queries)) {
+    return 1;
+  }
+  const int num_repetitions = std::max(FLAGS_num_repetitions, 1);
+  std::cout << "Loaded " << submaps.size() << " submaps (voxel size "
+            << submaps.front()->getEsdfMap().voxel_size() << "m) and "
+            << queries.size() << " queries in " << std::fixed
+            << std::setprecision(0) << millisecondsSince(t_load) << " ms."
+            << std::endl;
+
+  // Setup.
+  auto communicator = std::make_shared<Communicator>();
+  auto map = std::make_shared<OfflineSubmapMap>(submaps);
+  communicator->setupMap(map);
+  communicator->setupRegionOfInterest(std::make_shared<UnboundedRegion>());
+  SkeletonAStar::Config config;
+  config.traversability_radius = FLAGS_traversability_radius;
+  config.num_skeleton_generation_threads = FLAGS_num_threads;
+  config.use_hierarchical_search = FLAGS_use_hierarchical_search;
+  config.cache_edge_traversability = FLAGS_cache_edge_traversability;
+  SkeletonBenchmarkAStar planner(config, communicator);
+
+  // Skeleton generation and linking.
+  const auto t_generation = Clock::now();
+  for (const cblox::TsdfEsdfSubmap::Ptr& submap : submaps) {
+    planner.addSubmap(submap, config.traversability_radius);
+  }
+  planner.waitForPendingSubmaps();
+  const double generation_ms = millisecondsSince(t_generation);
+  map->resetQueryCounts();
+  const auto t_linking = Clock::now();
+  planner.updateLinkLayer();
+  const double linking_ms = millisecondsSince(t_linking);
+  size_t num_vertices = 0u;
+  for (const SkeletonSubmap::ConstPtr& submap :
+       planner.getSkeletonSubmapCollection().getSubmapConstPtrs()) {
+    num_vertices += submap->getNumVertices();
+  }
+  std::cout << "Skeletons: " << num_vertices << " vertices, generated in "
+            << std::setprecision(1) << generation_ms << " ms ("
+            << FLAGS_num_threads << " threads), linked in " << linking_ms
+            << " ms with " << map->getQueryCounts().total()
+            << " map queries." << std::endl;
+
+  // Queries.
+  std::cout << std::right << std::setw(5) << "query" << std::setw(6)
+            << "found" << std::setw(7) << "starts" << std::setw(7) << "goals"
+            << std::setw(8) << "portal" << std::setw(8) << "iters"
+            << std::setw(9) << "expanded"
+            << std::setw(9) << "checks" << std::setw(9) << "cached"
+            << std::setw(10) << "map qrys" << std::setw(11) << "plan ms"
+            << std::setw(11) << "closest ms" << std::setw(11) << "search ms"
+            << std::endl;
+  QueryResult total;
+  total.plan_path_ms = 0.0;
+  total.closest_vertices_ms = 0.0;
+  total.path_between_vertices_ms = 0.0;
+  size_t num_found_paths = 0u;
+  for (size_t i = 0u; i < queries.size(); ++i) {
+    const QueryResult result =
+        runQuery(queries[i], num_repetitions, &planner, map.get());
+    const SkeletonAStar::SearchStatistics& statistics =
+        result.search_statistics;
+    std::cout << std::setw(5) << i << std::setw(6)
+              << (result.found_path ? "yes" : "no") << std::setw(7)
+              << result.num_start_vertices << std::setw(7)
+              << result.num_goal_vertices << std::setw(8)
+              << statistics.num_portal_iterations << std::setw(8)
+              << statistics.num_iterations << std::setw(9)
+              << statistics.num_expanded_vertices << std::setw(9)
+              << statistics.num_traversability_checks << std::setw(9)
+              << statistics.num_cached_traversability_checks << std::setw(10)
+              << result.num_map_queries << std::setprecision(2)
+              << std::setw(11) << result.plan_path_ms << std::setw(11)
+              << result.closest_vertices_ms << std::setw(11)
+              << result.path_between_vertices_ms << std::endl;
+    num_found_paths += result.found_path;
+    total.search_statistics.num_portal_iterations +=
+        statistics.num_portal_iterations;
+    total.search_statistics.num_iterations += statistics.num_iterations;
+    total.search_statistics.num_expanded_vertices +=
+        statistics.num_expanded_vertices;
+    total.search_statistics.num_traversability_checks +=
+        statistics.num_traversability_checks;
+    total.search_statistics.num_cached_traversability_checks +=
+        statistics.num_cached_traversability_checks;
+    total.num_map_queries += result.num_map_queries;
+    total.plan_path_ms += result.plan_path_ms;
+    total.closest_vertices_ms += result.closest_vertices_ms;
+    total.path_between_vertices_ms += result.path_between_vertices_ms;
+  }
+  std::cout << std::setw(5) << "total" << std::setw(6) << num_found_paths
+            << std::setw(7) << "" << std::setw(7) << "" << std::setw(8)
+            << total.search_statistics.num_portal_iterations << std::setw(8)
+            << total.search_statistics.num_iterations << std::setw(9)
+            << total.search_statistics.num_expanded_vertices << std::setw(9)
+            << total.search_statistics.num_traversability_checks
+            << std::setw(9)
+            << total.search_statistics.num_cached_traversability_checks
+            << std::setw(10) << total.num_map_queries << std::setw(11)
+            << total.plan_path_ms << std::setw(11)
+            << total.closest_vertices_ms << std::setw(11)
+            << total.path_between_vertices_ms << std::endl;
+  return 0;
+}
+
+}  // namespace glocal_exploration
+
+int main(int argc, char** argv) {
+  FLAGS_logtostderr = true;
+  FLAGS_minloglevel = 1;  // The planner logs every search at INFO level.
+  google::SetUsageMessage(
+      "Benchmarks the skeleton global planner on saved submaps.\nUsage: "
+      "skeleton_benchmark --submap_directory=<path> --queries_file=<file>");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  if (FLAGS_submap_directory.empty() || FLAGS_queries_file.empty()) {
+    google::ShowUsageWithFlags(argv[0]);
+    return 1;
+  }
+  return glocal_exploration::runBenchmark();
+}
@@ -81,6 +81,10 @@ class MapBase {
 
   /* Global planner */
   virtual bool isObservedInGlobalMap(const Point& position) = 0;
+  // Batched version of isObservedInGlobalMap. Maps can override it to
+  // amortize lookups over many queries, by default each point is checked.
+  virtual void areObservedInGlobalMap(const std::vector<Point>& positions,
+                                      std::vector<bool>* is_observed);
 
   bool isTraversableInGlobalMap(const Point& position) {
     return isTraversableInGlobalMap(position, getTraversabilityRadius());
@@ -0,0 +1,72 @@
+#ifndef GLOCAL_EXPLORATION_PLANNING_GLOBAL_FRONTIER_CANDIDATES_H_
+#define GLOCAL_EXPLORATION_PLANNING_GLOBAL_FRONTIER_CANDIDATES_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <voxblox/core/common.h>
+
+#include "glocal_exploration/common.h"
+
+namespace glocal_exploration {
+/**
+ * Compact storage of the frontier candidates of a submap. The candidates are
+ * voxel centers in submap frame and are stored as uint16 voxel index triplets
+ * relative to the smallest index of the candidates. If the candidates span
+ * more voxels than that, the indices are stored as int32 triplets instead.
+ * The indices can optionally be spilled to a file, to release the memory of
+ * submaps that are currently not needed.
+ */
+class FrontierCandidates {
+ public:
+  FrontierCandidates() = default;
+  FrontierCandidates(const std::vector<Point>& candidates,
+                     FloatingPoint voxel_size);
+  ~FrontierCandidates();
+
+  // The spill file is owned by the object, so it can only be moved.
+  FrontierCandidates(const FrontierCandidates&) = delete;
+  FrontierCandidates& operator=(const FrontierCandidates&) = delete;
+  FrontierCandidates(FrontierCandidates&& other) noexcept;
+  FrontierCandidates& operator=(FrontierCandidates&& other) noexcept;
+
+  // Decompress the candidates, loading them from disk if they were spilled.
+  std::vector<Point> getPoints();
+
+  // Write the candidates to the given file and release their memory once the
+  // file was read back successfully. Otherwise they are kept in memory.
+  bool spillToFile(const std::string& file_path);
+  // Load spilled candidates back into memory and remove the file. If this
+  // fails, the candidates are lost and need to be recomputed.
+  bool loadFromFile();
+
+  size_t size() const { return num_candidates_; }
+  bool isSpilled() const { return !spill_file_path_.empty(); }
+  bool usesWideIndices() const { return uses_wide_indices_; }
+  size_t getMemorySize() const {
+    return packed_indices_.capacity() * sizeof(uint16_t) +
+           wide_indices_.capacity() * sizeof(int32_t);
+  }
+
+ private:
+  FloatingPoint voxel_size_ = 0.f;
+  size_t num_candidates_ = 0u;
+  voxblox::GlobalIndex min_index_ = voxblox::GlobalIndex::Zero();
+  bool uses_wide_indices_ = false;
+  // x, y, z of each candidate relative to min_index_, only one is used.
+  std::vector<uint16_t> packed_indices_;
+  std::vector<int32_t> wide_indices_;
+  std::string spill_file_path_;
+
+  // The raw bytes of the used index storage.
+  char* indexData();
+  size_t indexDataSize() const;
+  void resizeIndices(size_t size);
+  void releaseIndices();
+  void removeSpillFile();
+};
+
+}  // namespace glocal_exploration
+
+#endif  // GLOCAL_EXPLORATION_PLANNING_GLOBAL_FRONTIER_CANDIDATES_H_
@@ -1,6 +1,8 @@
 #ifndef GLOCAL_EXPLORATION_PLANNING_GLOBAL_SKELETON_GLOBAL_VERTEX_ID_H_
 #define GLOCAL_EXPLORATION_PLANNING_GLOBAL_SKELETON_GLOBAL_VERTEX_ID_H_
 
+#include <utility>
+
 #include <voxblox_skeleton/skeleton.h>
 
 #include "glocal_exploration/common.h"
@@ -40,6 +42,14 @@ struct GlobalVertexIdHash {
   }
 };
 
+struct GlobalVertexIdPairHash {
+  std::size_t operator()(
+      const std::pair<GlobalVertexId, GlobalVertexId>& index_pair) const {
+    const GlobalVertexIdHash hash;
+    return hash(index_pair.first) * 31u + hash(index_pair.second);
+  }
+};
+
 }  // namespace glocal_exploration
 
 #endif  // GLOCAL_EXPLORATION_PLANNING_GLOBAL_SKELETON_GLOBAL_VERTEX_ID_H_
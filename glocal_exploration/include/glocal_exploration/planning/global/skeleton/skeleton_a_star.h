@@ -2,9 +2,10 @@
 #define GLOCAL_EXPLORATION_PLANNING_GLOBAL_SKELETON_SKELETON_A_STAR_H_
 
 #include <functional>
-#include <map>
 #include <memory>
-#include <set>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -27,7 +28,19 @@ class SkeletonAStar {
     int linking_max_num_submaps = 20;
     int linking_max_num_links = 30;
     FloatingPoint linking_max_distance = 2.f;
+    // Submaps whose skeleton vertices moved by at most this distance [m]
+    // since they were linked keep their links, only the link positions are
+    // updated. Larger moves relink the submap and its neighbors.
+    FloatingPoint relink_pose_tolerance = 0.2f;
     int max_num_a_star_iterations = 5e3;
+    int max_num_dijkstra_iterations = 5e4;
+    // Reuse the traversability of skeleton edges across searches until the
+    // poses of the submaps around them change.
+    bool cache_edge_traversability = true;
+    int num_skeleton_generation_threads = 1;
+    // Search a graph of the submaps' portal vertices first and only refine
+    // the path within the corridor of submaps it passes through.
+    bool use_hierarchical_search = true;
 
     Config();
     void checkParams() const override;
@@ -35,18 +48,50 @@ class SkeletonAStar {
     void printFields() const override;
   };
 
+  using VertexIdMap =
+      std::unordered_map<GlobalVertexId, GlobalVertexId, GlobalVertexIdHash>;
+  using VertexIdSet = std::unordered_set<GlobalVertexId, GlobalVertexIdHash>;
   struct VisualizationEdges {
-    std::map<GlobalVertexId, GlobalVertexId> parent_map_;
-    std::map<GlobalVertexId, GlobalVertexId> intraversable_edge_map_;
+    VertexIdMap parent_map_;
+    VertexIdMap intraversable_edge_map_;
     void clear() {
       parent_map_.clear();
       intraversable_edge_map_.clear();
     }
   };
 
+  // Statistics of the most recent getPathBetweenVertices() call. With the
+  // hierarchical search, the counts are summed over the corridor search and
+  // the fallback search over all submaps, if it was needed.
+  struct SearchStatistics {
+    bool found_path = false;
+    size_t num_iterations = 0u;
+    size_t num_expanded_vertices = 0u;
+    size_t num_queued_vertices = 0u;
+    size_t num_traversability_checks = 0u;
+    size_t num_cached_traversability_checks = 0u;
+    size_t num_portal_iterations = 0u;  // Of the portal layer search.
+    size_t num_corridor_submaps = 0u;  // 0 if no corridor was searched.
+    bool used_fallback_search = false;
+    double search_time_ms = 0.0;
+  };
+
+  // A goal that is reached through any of its exit vertex candidates.
+  struct Goal {
+    Point goal_point;
+    std::vector<GlobalVertexId> exit_vertex_candidates;
+  };
+  struct GoalPath {
+    bool is_reachable = false;
+    FloatingPoint path_length = 0.f;  // From the start point to the goal.
+    std::vector<GlobalVertexId> vertex_path;  // Ends with the goal vertex.
+  };
+
   SkeletonAStar(const Config& config,
                 std::shared_ptr<Communicator> communicator)
-      : config_(config.checkValid()), comm_(std::move(communicator)) {}
+      : config_(config.checkValid()),
+        comm_(std::move(communicator)),
+        skeleton_submap_collection_(config_.num_skeleton_generation_threads) {}
 
   const Config& getConfig() const { return config_; }
   FloatingPoint getTraversabilityRadius() const {
@@ -56,16 +101,29 @@ class SkeletonAStar {
   bool planPath(const Point& start_point, const Point& goal_point,
                 std::vector<RelativeWayPoint>* way_points);
 
+  // Collect the newly generated skeletons, link them and relink the ones that
+  // moved, s.t. the searches run over a fixed graph. Call before planning.
+  void updateLinkLayer();
+  // Increased whenever the link layer update found new or moved submaps.
+  int getLinkLayerVersion() const { return link_layer_version_; }
+
+  // Returns whether the point can be connected to the skeleton vertex.
+  using VertexTraversabilityFunction = std::function<bool(
+      const Point& point, const GlobalVertexId& skeleton_vertex_id,
+      const Point& skeleton_vertex_point)>;
   std::vector<GlobalVertexId> searchClosestReachableSkeletonVertices(
       const Point& point, const int n_closest,
-      const std::function<bool(const Point& point,
-                               const Point& skeleton_vertex_point)>&
-          traversability_function) const;
+      const VertexTraversabilityFunction& traversability_function) const;
   bool getPathBetweenVertices(
       const std::vector<GlobalVertexId>& start_vertex,
       const std::vector<GlobalVertexId>& end_vertex_candidates,
       const voxblox::Point& start_point, const voxblox::Point& goal_point,
       std::vector<GlobalVertexId>* vertex_path) const;
+  // Find the shortest paths to all goals with a single search.
+  void getPathsToGoals(
+      const std::vector<GlobalVertexId>& start_vertex_candidates,
+      const Point& start_point, const std::vector<Goal>& goals,
+      std::vector<GoalPath>* goal_paths) const;
   void convertVertexToWaypointPath(
       const std::vector<GlobalVertexId>& vertex_path, const Point& goal_point,
       std::vector<RelativeWayPoint>* way_points) const;
@@ -73,6 +131,8 @@ class SkeletonAStar {
   const SkeletonSubmapCollection& getSkeletonSubmapCollection() const {
     return skeleton_submap_collection_;
   }
+  // The skeleton is generated in the background and only used for planning
+  // once it is complete.
   void addSubmap(cblox::TsdfEsdfSubmap::ConstPtr submap_ptr,
                  const float traversability_radius) {
     skeleton_submap_collection_.addSubmap(std::move(submap_ptr),
@@ -83,6 +143,10 @@ class SkeletonAStar {
     std::lock_guard<std::mutex> lock_guard(visualization_data_mutex_);
     return visualization_edges_;
   }
+  SearchStatistics getLastSearchStatistics() const {
+    std::lock_guard<std::mutex> lock_guard(visualization_data_mutex_);
+    return last_search_statistics_;
+  }
 
  protected:
   const Config config_;
@@ -92,18 +156,107 @@ class SkeletonAStar {
 
   const GlobalVertexId kGoalVertexId{RelativeWayPoint::kOdomFrameId, -1u};
 
-  static void getSolutionVertexPath(
-      GlobalVertexId end_vertex_id,
-      const std::map<GlobalVertexId, GlobalVertexId>& parent_map,
-      std::vector<GlobalVertexId>* vertex_path);
+  // Link layer, storing the traversable edges between the skeletons of
+  // different submaps, by start vertex.
+  struct InterSubmapLink {
+    GlobalVertexId target_vertex_id;
+    Point t_odom_target_vertex;
+    FloatingPoint length;
+  };
+  std::unordered_map<GlobalVertexId, std::vector<InterSubmapLink>,
+                     GlobalVertexIdHash>
+      inter_submap_links_;
+  // The poses at which the submaps were linked and at which the positions of
+  // their links were last updated.
+  struct LinkedSubmapPose {
+    Transformation T_odom_submap_linked;
+    Transformation T_odom_submap_updated;
+  };
+  std::unordered_map<SubmapId, LinkedSubmapPose> linked_submap_poses_;
+  int link_layer_version_ = 0;
+  // The submaps that have links into each submap.
+  std::unordered_map<SubmapId, std::unordered_set<SubmapId>>
+      submaps_linking_to_;
+
+  void linkSubmap(const SkeletonSubmap& submap);
+  // Recomputes the target positions and lengths of the links starting in the
+  // submap from the current submap poses, without checking them again.
+  void updateLinkPositions(const SkeletonSubmap& submap);
+
+  // Portal layer, used to find the corridor of submaps a path passes through.
+  // The source vertex of the shortest link from a submap to each neighboring
+  // submap serves as portal. The distances from each portal to all vertices
+  // of its submap are precomputed along the submap's skeleton.
+  // NOTE: The traversability of the skeleton edges is only checked in the
+  //       refinement, so the portal distances are optimistic.
+  struct Portal {
+    GlobalVertexId vertex_id;
+    std::vector<InterSubmapLink> links;
+    std::unordered_map<VertexIdElement, FloatingPoint> vertex_distances;
+  };
+  std::unordered_map<SubmapId, std::unordered_map<VertexIdElement, Portal>>
+      submap_portals_;
+  void updateSubmapPortals(const SkeletonSubmap& submap);
+  // Returns the submaps that the shortest portal path passes through, which
+  // always include the submaps of the start and end vertex candidates.
+  bool searchSubmapCorridor(
+      const std::vector<GlobalVertexId>& start_vertex_candidates,
+      const std::vector<GlobalVertexId>& end_vertex_candidates,
+      const Point& start_point, const Point& goal_point,
+      std::unordered_set<SubmapId>* corridor,
+      SearchStatistics* statistics) const;
+  // A* search over the skeleton vertices. If a corridor is given, only the
+  // vertices of the submaps in the corridor are considered. The counts are
+  // added to the statistics.
+  bool searchPathBetweenVertices(
+      const std::vector<GlobalVertexId>& start_vertex_candidates,
+      const std::vector<GlobalVertexId>& end_vertex_candidates,
+      const Point& start_point, const Point& goal_point,
+      const std::unordered_set<SubmapId>* corridor,
+      std::vector<GlobalVertexId>* vertex_path,
+      SearchStatistics* statistics) const;
+
+  // Traversability of the skeleton edges by (ordered) vertex pair. An entry is
+  // valid as long as the neighborhood version of the edge's submap, which is
+  // increased whenever the submap or a submap around it changes, matches.
+  // NOTE: Only accessed from the planning thread.
+  struct EdgeTraversability {
+    bool is_traversable = false;
+    int neighborhood_version = 0;
+  };
+  mutable std::unordered_map<std::pair<GlobalVertexId, GlobalVertexId>,
+                             EdgeTraversability, GlobalVertexIdPairHash>
+      edge_traversability_cache_;
+  std::unordered_map<SubmapId, int> submap_neighborhood_versions_;
+  bool isEdgeTraversable(const GlobalVertexId& start_vertex_id,
+                         const GlobalVertexId& end_vertex_id,
+                         const Point& t_odom_start_vertex,
+                         const Point& t_odom_end_vertex,
+                         SearchStatistics* statistics) const;
+
+  // Calls the function for all traversable neighbors of the vertex that are
+  // not closed yet, following the skeleton edges and the link layer.
+  using NeighborFunction = std::function<void(
+      const GlobalVertexId& neighbor_vertex_id,
+      const Point& t_odom_neighbor_vertex, FloatingPoint edge_length)>;
+  void expandVertex(const GlobalVertexId& vertex_id,
+                    const SkeletonSubmap& submap, const VertexIdSet& closed_set,
+                    VertexIdMap* intraversable_edge_map,
+                    SearchStatistics* statistics,
+                    const NeighborFunction& function) const;
+  // Largest distance any vertex of the submap moves between the two poses.
+  static FloatingPoint maxVertexDisplacement(const SkeletonSubmap& submap,
+                                             const Transformation& T_O_S_old,
+                                             const Transformation& T_O_S_new);
 
-  static GlobalVertexId popSmallestFromOpen(
-      const std::map<GlobalVertexId, FloatingPoint>& f_score_map,
-      std::set<GlobalVertexId>* open_set);
+  static void getSolutionVertexPath(GlobalVertexId end_vertex_id,
+                                    const VertexIdMap& parent_map,
+                                    std::vector<GlobalVertexId>* vertex_path);
 
-  // Persistent only for visualization purposes.
+  // Persistent only for visualization and introspection purposes.
   // Only used within getPathBetweenVertices().
   mutable VisualizationEdges visualization_edges_;
+  mutable SearchStatistics last_search_statistics_;
   mutable std::mutex visualization_data_mutex_;
 };
 }  // namespace glocal_exploration
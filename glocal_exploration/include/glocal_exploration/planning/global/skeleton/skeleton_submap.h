@@ -11,6 +11,8 @@
 #include <voxblox_skeleton/skeleton_generator.h>
 #include <voxblox_skeleton/sparse_graph_planner.h>
 
+#include "glocal_exploration/planning/global/skeleton/global_vertex_id.h"
+
 namespace glocal_exploration {
 class SkeletonSubmap {
  public:
@@ -21,17 +23,39 @@ class SkeletonSubmap {
                  const float traversability_radius)
       : submap_ptr_(CHECK_NOTNULL(submap_ptr)),
         traversability_radius_(traversability_radius),
-        graph_(generateSparseSkeletonGraph(*submap_ptr, traversability_radius)),
-        kd_tree_adapter_(graph_.getVertexMap()),
+        frozen_graph_(freezeGraph(
+            generateSparseSkeletonGraph(*submap_ptr, traversability_radius))),
+        kd_tree_adapter_{&frozen_graph_.vertex_points},
         kd_tree_(
             kDTreeDim, kd_tree_adapter_,
             voxblox::nanoflann::KDTreeSingleIndexAdaptorParams(kDTreeMaxLeaf)) {
     kd_tree_.buildIndex();
   }
 
-  const voxblox::SparseSkeletonGraph& getSkeletonGraph() const {
-    return graph_;
+  // Frozen graph access. The vertex ids of the generated sparse graph are
+  // consecutive, so they directly index the contiguous vertex and neighbor
+  // arrays. The sparse graph itself is discarded once it is frozen.
+  struct Neighbor {
+    VertexIdElement vertex_id;
+    FloatingPoint edge_length;
+  };
+  struct NeighborRange {
+    const Neighbor* begin_ptr;
+    const Neighbor* end_ptr;
+    const Neighbor* begin() const { return begin_ptr; }
+    const Neighbor* end() const { return end_ptr; }
+    size_t size() const { return end_ptr - begin_ptr; }
+  };
+  size_t getNumVertices() const { return frozen_graph_.vertex_points.size(); }
+  const Point& getVertexPoint(const VertexIdElement vertex_id) const {
+    return frozen_graph_.vertex_points[vertex_id];
+  }
+  NeighborRange getNeighbors(const VertexIdElement vertex_id) const {
+    const Neighbor* neighbors = frozen_graph_.neighbors.data();
+    return {neighbors + frozen_graph_.neighbor_offsets[vertex_id],
+            neighbors + frozen_graph_.neighbor_offsets[vertex_id + 1]};
   }
+
   size_t getNClosestVertices(const voxblox::Point& point, int num_vertices,
                              std::vector<int64_t>* vertex_inds) const {
     CHECK_NOTNULL(vertex_inds);
@@ -61,7 +85,6 @@ class SkeletonSubmap {
   cblox::TsdfEsdfSubmap::ConstPtr submap_ptr_;
   const float traversability_radius_;
 
-  voxblox::SparseSkeletonGraph graph_;
   static voxblox::SparseSkeletonGraph generateSparseSkeletonGraph(
       const cblox::TsdfEsdfSubmap& submap, const float traversability_radius) {
     voxblox::SkeletonGenerator skeleton_generator(
@@ -74,10 +97,74 @@ class SkeletonSubmap {
     return skeleton_generator.getSparseGraph();
   }
 
+  // Immutable copy of the sparse graph, with the vertex positions packed and
+  // the adjacency in compressed sparse row format: the neighbors of vertex i
+  // are neighbors[neighbor_offsets[i]] to neighbors[neighbor_offsets[i+1]].
+  struct FrozenGraph {
+    std::vector<Point> vertex_points;
+    std::vector<size_t> neighbor_offsets;
+    std::vector<Neighbor> neighbors;
+  };
+  const FrozenGraph frozen_graph_;
+  static FrozenGraph freezeGraph(const voxblox::SparseSkeletonGraph& graph) {
+    FrozenGraph frozen_graph;
+    const size_t num_vertices = graph.getVertexMap().size();
+    frozen_graph.vertex_points.resize(num_vertices);
+    frozen_graph.neighbor_offsets.assign(num_vertices + 1u, 0u);
+    for (const auto& vertex_kv : graph.getVertexMap()) {
+      const voxblox::SkeletonVertex& vertex = vertex_kv.second;
+      CHECK_GE(vertex.vertex_id, 0);
+      CHECK_LT(static_cast<size_t>(vertex.vertex_id), num_vertices)
+          << "The skeleton vertex ids are expected to be consecutive.";
+      frozen_graph.vertex_points[vertex.vertex_id] = vertex.point;
+      frozen_graph.neighbor_offsets[vertex.vertex_id + 1] =
+          vertex.edge_list.size();
+    }
+    for (size_t i = 0u; i < num_vertices; ++i) {
+      frozen_graph.neighbor_offsets[i + 1] += frozen_graph.neighbor_offsets[i];
+    }
+    frozen_graph.neighbors.resize(frozen_graph.neighbor_offsets.back());
+    for (const auto& vertex_kv : graph.getVertexMap()) {
+      const voxblox::SkeletonVertex& vertex = vertex_kv.second;
+      size_t neighbor_index = frozen_graph.neighbor_offsets[vertex.vertex_id];
+      for (const int64_t edge_id : vertex.edge_list) {
+        const voxblox::SkeletonEdge& edge = graph.getEdge(edge_id);
+        const VertexIdElement neighbor_vertex_id =
+            edge.start_vertex == vertex.vertex_id ? edge.end_vertex
+                                                  : edge.start_vertex;
+        frozen_graph.neighbors[neighbor_index++] = {
+            neighbor_vertex_id,
+            (graph.getVertex(neighbor_vertex_id).point - vertex.point).norm()};
+      }
+    }
+    return frozen_graph;
+  }
+
+  // Nanoflann adapter over the packed vertex positions.
+  struct VertexPointsAdapter {
+    const std::vector<Point>* points;
+    inline size_t kdtree_get_point_count() const { return points->size(); }
+    inline FloatingPoint kdtree_get_pt(const size_t idx, int dim) const {
+      return (*points)[idx](dim);
+    }
+    inline FloatingPoint kdtree_distance(const FloatingPoint* p1,
+                                         const size_t idx_p2,
+                                         size_t /*size*/) const {
+      return (Eigen::Map<const Point>(p1) - (*points)[idx_p2]).squaredNorm();
+    }
+    template <class BBOX>
+    bool kdtree_get_bbox(BBOX& /* bb */) const {
+      return false;
+    }
+  };
+  using VertexKdTree = voxblox::nanoflann::KDTreeSingleIndexAdaptor<
+      voxblox::nanoflann::L2_Simple_Adaptor<FloatingPoint, VertexPointsAdapter>,
+      VertexPointsAdapter, 3>;
+
   const int kDTreeDim = 3;
   const int kDTreeMaxLeaf = 10;
-  voxblox::DirectSkeletonVertexMapAdapter kd_tree_adapter_;
-  voxblox::SparseGraphPlanner::VertexGraphKdTree kd_tree_;
+  VertexPointsAdapter kd_tree_adapter_;
+  VertexKdTree kd_tree_;
 };
 }  // namespace glocal_exploration
 
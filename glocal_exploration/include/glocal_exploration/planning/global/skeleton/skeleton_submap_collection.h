@@ -1,24 +1,56 @@
 #ifndef GLOCAL_EXPLORATION_PLANNING_GLOBAL_SKELETON_SKELETON_SUBMAP_COLLECTION_H_
 #define GLOCAL_EXPLORATION_PLANNING_GLOBAL_SKELETON_SKELETON_SUBMAP_COLLECTION_H_
 
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 
 #include "glocal_exploration/planning/global/skeleton/skeleton_submap.h"
+#include "glocal_exploration/utils/thread_pool.h"
 
 namespace glocal_exploration {
+/**
+ * Holds the skeletons of all submaps. The skeletons are generated by a pool
+ * of background workers, s.t. adding a submap does not block the caller, and
+ * are only exposed once they are complete and have been collected.
+ */
 class SkeletonSubmapCollection {
  public:
+  // Timings of the skeleton generation, where the latency also includes the
+  // time spent waiting for a free worker.
+  struct GenerationStatistics {
+    size_t num_generated_submaps = 0u;
+    double total_generation_time_ms = 0.0;
+    double max_generation_time_ms = 0.0;
+    double total_latency_ms = 0.0;
+    double max_latency_ms = 0.0;
+  };
+
+  explicit SkeletonSubmapCollection(int num_generation_threads = 1)
+      : generation_workers_(num_generation_threads) {}
+
+  // Schedule the skeleton generation for the submap.
   void addSubmap(cblox::TsdfEsdfSubmap::ConstPtr submap_ptr,
-                 const float traversability_radius) {
-    CHECK_NOTNULL(submap_ptr);
-    skeleton_submaps_.emplace(
-        submap_ptr->getID(),
-        std::make_shared<SkeletonSubmap>(submap_ptr, traversability_radius));
+                 const float traversability_radius);
+
+  // Expose the skeletons that finished generating since the last call.
+  // Returns whether any new skeletons were added.
+  bool collectFinishedSubmaps();
+  // Block until all scheduled skeletons are generated and collect them.
+  void waitForPendingSubmaps();
+  size_t getNumPendingSubmaps() const {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    return pending_submaps_.size();
+  }
+  GenerationStatistics getGenerationStatistics() const {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    return generation_statistics_;
   }
 
   const SkeletonSubmap& getSubmapById(const SubmapId submap_id) const {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
     auto it = skeleton_submaps_.find(submap_id);
     CHECK(it != skeleton_submaps_.end())
         << "Could not find skeleton submap with ID " << submap_id;
@@ -27,6 +59,7 @@ class SkeletonSubmapCollection {
 
   SkeletonSubmap::ConstPtr getSubmapConstPtrById(
       const SubmapId submap_id) const {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
     auto it = skeleton_submaps_.find(submap_id);
     if (it == skeleton_submaps_.end()) {
       return nullptr;
@@ -36,6 +69,7 @@ class SkeletonSubmapCollection {
   }
 
   std::list<SkeletonSubmap::ConstPtr> getSubmapConstPtrs() const {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
     std::list<SkeletonSubmap::ConstPtr> submap_list;
     for (const auto& submap_kv : skeleton_submaps_) {
       submap_list.emplace_back(submap_kv.second);
@@ -44,7 +78,24 @@ class SkeletonSubmapCollection {
   }
 
  private:
+  struct GenerationResult {
+    SkeletonSubmap::Ptr submap;
+    double generation_time_ms;
+    double latency_ms;
+  };
+  void addFinishedSubmap(SubmapId submap_id, GenerationResult result);
+
+  // NOTE: The submaps are never removed, so references to them stay valid.
   std::map<SubmapId, SkeletonSubmap::Ptr> skeleton_submaps_;
+  // NOTE: The futures are shared, s.t. the submaps can be waited for while
+  //       they stay pending and are not scheduled again by addSubmap().
+  std::map<SubmapId, std::shared_future<GenerationResult>> pending_submaps_;
+  GenerationStatistics generation_statistics_;
+  mutable std::mutex submaps_mutex_;
+
+  // NOTE: Declared last, s.t. the workers are joined before the members
+  //       above are destroyed.
+  ThreadPool generation_workers_;
 };
 }  // namespace glocal_exploration
 
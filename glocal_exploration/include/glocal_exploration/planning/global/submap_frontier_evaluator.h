@@ -1,14 +1,20 @@
 #ifndef GLOCAL_EXPLORATION_PLANNING_GLOBAL_SUBMAP_FRONTIER_EVALUATOR_H_
 #define GLOCAL_EXPLORATION_PLANNING_GLOBAL_SUBMAP_FRONTIER_EVALUATOR_H_
 
+#include <cstdint>
+#include <future>
 #include <memory>
-#include <thread>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "glocal_exploration/3rd_party/config_utilities.hpp"
+#include "glocal_exploration/planning/global/frontier_candidates.h"
 #include "glocal_exploration/planning/global/global_planner_base.h"
+#include "glocal_exploration/utils/thread_pool.h"
 
 namespace glocal_exploration {
 /**
@@ -23,6 +29,25 @@ class SubmapFrontierEvaluator : public GlobalPlannerBase {
     bool submaps_are_frozen = true;  // false: submap frontiers will be
                                      // recomputed and overwritten.
     int min_num_visible_frontier_points = 1;
+    int num_threads = 4;  // Used to compute submap frontier candidates.
+    // Submaps whose extent moved by at most this many voxels since their
+    // candidates were inserted into the global frontiers keep them.
+    FloatingPoint pose_change_tolerance = 1.f;  // voxels
+    // Only extract candidates within the bounding box of the region of
+    // interest, enlarged by the margin to tolerate later submap pose changes.
+    // NOTE: Frozen submaps are never extracted again, so candidates that only
+    //       enter the ROI after a pose correction larger than the margin are
+    //       lost. Off by default for this reason.
+    bool clip_candidates_to_roi = false;
+    FloatingPoint roi_clipping_margin = 1.f;  // m
+    // Maximum number of points kept in each frontier summary.
+    int max_num_representative_points = 64;
+    // Candidates of submaps further than spill_distance from the robot can
+    // be written to disk, to bound the memory usage on large explorations.
+    // Each evaluator spills into its own subdirectory of spill_directory.
+    bool spill_candidates_to_disk = false;
+    FloatingPoint spill_distance = 100.f;  // m
+    std::string spill_directory = "/tmp";
 
     Config();
     void checkParams() const override;
@@ -34,34 +59,96 @@ class SubmapFrontierEvaluator : public GlobalPlannerBase {
   using Index = voxblox::GlobalIndex;
   using IndexSet = voxblox::LongIndexSet;
 
+  // Summary of an active frontier, computed once when it is clustered.
+  struct FrontierSummary {
+    // Unique, s.t. an id always refers to the same set of points.
+    int cluster_id = -1;
+    Point centroid = Point::Zero();
+    Point aabb_min = Point::Zero();
+    Point aabb_max = Point::Zero();
+    int num_points = 0;
+    // Unit vector along which the frontier points are spread the most.
+    Point principal_direction = Point::UnitX();
+    // Evenly subsampled frontier points.
+    std::vector<Point> representative_points;
+  };
+
+  // Region of interest of a submap, used to clip the candidate extraction.
+  enum class RegionOverlap { kInside, kOutside, kPartial };
+  struct SubmapRegion {
+    bool is_bounded = false;
+    Transformation T_M_S;
+    Point min_corner_M = Point::Zero();
+    Point max_corner_M = Point::Zero();
+
+    bool contains(const Point& point_S) const;
+    RegionOverlap classifyBlock(const voxblox::BlockIndex& block_index,
+                                FloatingPoint block_size) const;
+  };
+  using BlockOverlapMap = voxblox::AnyIndexHashMapType<RegionOverlap>::type;
+
   // Construction.
   SubmapFrontierEvaluator(const Config& config,
                           std::shared_ptr<Communicator> communicator);
-  ~SubmapFrontierEvaluator() override = default;
+  ~SubmapFrontierEvaluator() override;
 
   // Methods.
+  // Schedule the frontier candidate computation on the thread pool.
   void computeFrontiersForSubmap(const MapBase::SubmapData& data,
                                  const Point& initial_point);
 
+  // Waits for the candidates of the given submaps only.
   void updateFrontiers(const std::vector<MapBase::SubmapData>& data);
 
-  // Access.
-  const std::unordered_map<int, std::vector<Point>>& getFrontierCandidates()
+  // Access. Only safe to use from the planning thread.
+  const std::unordered_map<int, FrontierCandidates>& getFrontierCandidates()
       const {
     return frontier_candidates_;
   }
   const std::vector<std::vector<Point>>& getActiveFrontiers() const {
     return active_frontiers_;
   }
+  // The summaries are ordered the same way as the active frontiers.
+  const std::vector<FrontierSummary>& getActiveFrontierSummaries() const {
+    return active_frontier_summaries_;
+  }
   const std::vector<Point>& getInactiveFrontiers() const {
     return inactive_frontiers_;
   }
 
  protected:
-  void computeFrontierCandidates(
+  std::vector<Point> computeFrontierCandidates(
+      const voxblox::Layer<voxblox::TsdfVoxel>& layer,
+      const Point& initial_point, int submap_id,
+      const SubmapRegion& region = SubmapRegion()) const;
+  // Block-wise bitmask sweep, used if the block rows fit into a word.
+  std::vector<Point> sweepFrontierCandidates(
+      const voxblox::Layer<voxblox::TsdfVoxel>& layer,
+      const SubmapRegion& region = SubmapRegion()) const;
+  // Voxel-wise flood fill of the free space connected to the initial point.
+  std::vector<Point> searchFrontierCandidates(
       const voxblox::Layer<voxblox::TsdfVoxel>& layer,
       const Point& initial_point,
-      std::pair<const int, std::vector<Point>>* output);
+      const SubmapRegion& region = SubmapRegion()) const;
+  // The overlap of all allocated blocks and their neighbors with the region.
+  // Blocks outside the region are not included.
+  BlockOverlapMap classifyBlocks(
+      const voxblox::Layer<voxblox::TsdfVoxel>& layer,
+      const SubmapRegion& region) const;
+  SubmapRegion computeSubmapRegion(const MapBase::SubmapData& data) const;
+  // Returns the ids of the submaps whose candidates were (re)computed.
+  std::unordered_set<int> collectFrontierCandidates(
+      const std::vector<MapBase::SubmapData>& data);
+  // Spill the candidates of far away submaps to disk.
+  void spillFrontierCandidates();
+  FrontierSummary summarizeFrontier(const std::vector<Point>& points) const;
+  // Split the points into 26-connected clusters.
+  std::vector<std::vector<Index>> clusterFrontierPoints(
+      const IndexSet& points) const;
+
+  // Mission frame cells (of kCellSizeInVoxels) overlapped by the submap.
+  voxblox::IndexSet computeFootprintCells(const MapBase::SubmapData& data,
+                                          FloatingPoint cell_size_inv) const;
 
   Index indexFromPoint(const Point& point, FloatingPoint voxel_size_inv) const;
   Point centerPointFromIndex(const Index& index,
@@ -69,20 +156,63 @@ class SubmapFrontierEvaluator : public GlobalPlannerBase {
   MapBase::VoxelState voxelState(
       const Index& index,
       const voxblox::Layer<voxblox::TsdfVoxel>& layer) const;
+  // Classification of a single voxel, shared by all frontier searches.
+  static MapBase::VoxelState classifyVoxel(const voxblox::TsdfVoxel& voxel,
+                                           FloatingPoint voxel_size);
 
  protected:
   const Config config_;
 
-  // Aloow frontier computation in the background, although not in parallel.
-  std::unique_ptr<std::thread> frontier_computation_thread_;
-
   // Store for each submap id (first) all candidates (second) in submap frame.
-  std::unordered_map<int, std::vector<Point>> frontier_candidates_;
+  // NOTE: Only modified from the planning thread, but searched by the new
+  //       submap callbacks, so the map itself is guarded by the pending
+  //       candidates mutex.
+  std::unordered_map<int, FrontierCandidates> frontier_candidates_;
+  // Created on the first spill and removed with the evaluator.
+  std::string unique_spill_directory_;
+
+  // Candidates that are still being computed in the background.
+  std::unordered_map<int, std::future<FrontierCandidates>>
+      pending_frontier_candidates_;
+  std::mutex pending_frontier_candidates_mutex_;
+
+  // Persistent global frontier index, s.t. it can be updated incrementally.
+  struct TrackedSubmap {
+    Transformation T_M_S;  // Pose at which the candidates were inserted.
+    std::vector<Index> global_points;  // Candidates within the ROI.
+    voxblox::IndexSet footprint_cells;
+    // Bounding box of the submap's allocated blocks in submap frame.
+    Point extent_min_S = Point::Zero();
+    Point extent_max_S = Point::Zero();
+  };
+  struct GlobalCandidate {
+    int num_submaps = 0;  // Number of submaps that have this candidate.
+    bool is_observed = false;
+  };
+  static constexpr int kCellSizeInVoxels = 16;
+  std::unordered_map<int, TrackedSubmap> tracked_submaps_;
+  voxblox::LongIndexHashMapType<GlobalCandidate>::type global_candidates_;
+  // Largest distance any point within the extent of the tracked submap moves
+  // between the pose it was inserted at and the new pose.
+  static FloatingPoint maxExtentDisplacement(const TrackedSubmap& submap,
+                                             const Transformation& T_M_S_new);
+  std::unordered_map<int, std::vector<Index>> clusters_;
+  std::unordered_map<int, FrontierSummary> cluster_summaries_;
+  voxblox::LongIndexHashMapType<int>::type active_point_to_cluster_;
+  int next_cluster_id_ = 0;
 
   // Active frontiers (set of connected active candidates) in mission frame.
   std::vector<std::vector<Point>> active_frontiers_;
+  std::vector<FrontierSummary> active_frontier_summaries_;
   std::vector<Point> inactive_frontiers_;
 
+  // Dense voxel classification of a block, one word per row along x.
+  struct BlockMasks {
+    std::vector<uint64_t> free_rows;
+    std::vector<uint64_t> observed_rows;
+  };
+  static constexpr int kMaxVoxelsPerSideForSweep = 64;
+
   // Neighbor lookup.
   const Index kNeighborOffsets[26] = {
       Index(1, 0, 0),   Index(1, 1, 0),   Index(1, -1, 0),  Index(1, 0, 1),
@@ -92,6 +222,10 @@ class SubmapFrontierEvaluator : public GlobalPlannerBase {
       Index(0, -1, -1), Index(-1, 0, 0),  Index(-1, 1, 0),  Index(-1, -1, 0),
       Index(-1, 0, 1),  Index(-1, 1, 1),  Index(-1, -1, 1), Index(-1, 0, -1),
       Index(-1, 1, -1), Index(-1, -1, -1)};
+
+  // NOTE: Declared last, s.t. the workers are joined before the members that
+  //       the queued tasks use are destructed.
+  ThreadPool thread_pool_;
 };
 
 }  // namespace glocal_exploration
@@ -2,6 +2,7 @@
 #define GLOCAL_EXPLORATION_STATE_COMMUNICATOR_H_
 
 #include <memory>
+#include <mutex>
 
 #include "glocal_exploration/common.h"
 #include "glocal_exploration/mapping/map_base.h"
@@ -24,7 +25,12 @@ class Communicator {
 
   // general information accessors
   bool targetIsReached() const { return target_reached_; }
-  const WayPoint& currentPose() const { return current_pose_; }
+  // NOTE: The pose is set by the odometry callback but also read by the map
+  //       workers, so it is returned as a copy.
+  WayPoint currentPose() const {
+    std::lock_guard<std::mutex> lock(current_pose_mutex_);
+    return current_pose_;
+  }
   bool newWayPointIsRequested() const { return new_waypoint_requested_; }
 
   // componet accessors
@@ -54,7 +60,10 @@ class Communicator {
   void setTargetReached(bool target_reached) {
     target_reached_ = target_reached;
   }
-  void setCurrentPose(const WayPoint& pose) { current_pose_ = pose; }
+  void setCurrentPose(const WayPoint& pose) {
+    std::lock_guard<std::mutex> lock(current_pose_mutex_);
+    current_pose_ = pose;
+  }
   void setRequestedWayPointRead() { new_waypoint_requested_ = false; }
 
   // setup tools for the main node
@@ -75,6 +84,7 @@ class Communicator {
   // General information is provided by the node and usable by the planners
   bool target_reached_;
   WayPoint current_pose_;
+  mutable std::mutex current_pose_mutex_;
   WayPoint target_way_point_;
   WayPoint previous_target_way_point_;
   bool new_waypoint_requested_;
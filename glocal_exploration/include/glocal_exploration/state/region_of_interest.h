@@ -15,6 +15,12 @@ class RegionOfInterest {
   virtual ~RegionOfInterest() = default;
 
   virtual bool contains(const Point& point) = 0;
+
+  // Axis aligned box that contains the region. Returns false if the region is
+  // unbounded.
+  virtual bool getBoundingBox(Point* min_corner, Point* max_corner) const {
+    return false;
+  }
 };
 
 /**
@@ -40,6 +46,7 @@ class BoundingBox : public RegionOfInterest {
   ~BoundingBox() override = default;
 
   bool contains(const Point& point) override;
+  bool getBoundingBox(Point* min_corner, Point* max_corner) const override;
 
  protected:
   const Config config_;
@@ -0,0 +1,122 @@
+#ifndef GLOCAL_EXPLORATION_UTILS_INDEXED_PRIORITY_QUEUE_H_
+#define GLOCAL_EXPLORATION_UTILS_INDEXED_PRIORITY_QUEUE_H_
+
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace glocal_exploration {
+
+/**
+ * Binary min-heap that contains each key at most once. The position of every
+ * key in the heap is tracked, s.t. the priority of a queued key can be
+ * decreased in O(log n) instead of queuing it again.
+ */
+template <typename Key, typename Priority, typename Hash = std::hash<Key>>
+class IndexedPriorityQueue {
+ public:
+  bool empty() const { return heap_.empty(); }
+  size_t size() const { return heap_.size(); }
+  bool contains(const Key& key) const {
+    return positions_.find(key) != positions_.end();
+  }
+  const Key& top() const {
+    CHECK(!heap_.empty());
+    return heap_.front().first;
+  }
+
+  void clear() {
+    heap_.clear();
+    positions_.clear();
+  }
+  void reserve(size_t size) {
+    heap_.reserve(size);
+    positions_.reserve(size);
+  }
+
+  // Queue the key, or lower its priority if it is already queued with a
+  // higher one. Returns whether the queue changed.
+  bool pushOrDecrease(const Key& key, Priority priority) {
+    auto it = positions_.find(key);
+    if (it == positions_.end()) {
+      positions_.emplace(key, heap_.size());
+      heap_.emplace_back(key, priority);
+      siftUp(heap_.size() - 1u);
+      return true;
+    }
+    Entry& entry = heap_[it->second];
+    if (!(priority < entry.second)) {
+      return false;
+    }
+    entry.second = priority;
+    siftUp(it->second);
+    return true;
+  }
+
+  // Remove and return the key with the lowest priority.
+  Key pop() {
+    CHECK(!heap_.empty());
+    Key result = std::move(heap_.front().first);
+    positions_.erase(result);
+    if (heap_.size() > 1u) {
+      heap_.front() = std::move(heap_.back());
+      heap_.pop_back();
+      positions_[heap_.front().first] = 0u;
+      siftDown(0u);
+    } else {
+      heap_.pop_back();
+    }
+    return result;
+  }
+
+ private:
+  using Entry = std::pair<Key, Priority>;
+
+  void siftUp(size_t position) {
+    while (position > 0u) {
+      const size_t parent = (position - 1u) / 2u;
+      if (!(heap_[position].second < heap_[parent].second)) {
+        break;
+      }
+      swapEntries(position, parent);
+      position = parent;
+    }
+  }
+
+  void siftDown(size_t position) {
+    while (true) {
+      const size_t left = 2u * position + 1u;
+      const size_t right = left + 1u;
+      size_t smallest = position;
+      if (left < heap_.size() &&
+          heap_[left].second < heap_[smallest].second) {
+        smallest = left;
+      }
+      if (right < heap_.size() &&
+          heap_[right].second < heap_[smallest].second) {
+        smallest = right;
+      }
+      if (smallest == position) {
+        return;
+      }
+      swapEntries(position, smallest);
+      position = smallest;
+    }
+  }
+
+  void swapEntries(size_t a, size_t b) {
+    std::swap(heap_[a], heap_[b]);
+    positions_[heap_[a].first] = a;
+    positions_[heap_[b].first] = b;
+  }
+
+  std::vector<Entry> heap_;
+  std::unordered_map<Key, size_t, Hash> positions_;
+};
+
+}  // namespace glocal_exploration
+
+#endif  // GLOCAL_EXPLORATION_UTILS_INDEXED_PRIORITY_QUEUE_H_
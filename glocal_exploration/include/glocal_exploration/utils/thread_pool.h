@@ -0,0 +1,90 @@
+#ifndef GLOCAL_EXPLORATION_UTILS_THREAD_POOL_H_
+#define GLOCAL_EXPLORATION_UTILS_THREAD_POOL_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace glocal_exploration {
+
+/**
+ * A fixed size pool of worker threads that process a FIFO task queue. The
+ * result of each task can be retrieved through the returned future. On
+ * destruction all queued tasks are completed before the workers are joined.
+ */
+class ThreadPool {
+ public:
+  explicit ThreadPool(int num_threads) {
+    for (int i = 0; i < std::max(num_threads, 1); ++i) {
+      workers_.emplace_back(&ThreadPool::workerLoop, this);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      shutdown_requested_ = true;
+    }
+    queue_condition_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Prevent copying
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  template <typename Function>
+  std::future<std::invoke_result_t<Function>> enqueue(Function&& function) {
+    using ResultType = std::invoke_result_t<Function>;
+    auto task = std::make_shared<std::packaged_task<ResultType()>>(
+        std::forward<Function>(function));
+    std::future<ResultType> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      tasks_.emplace([task] { (*task)(); });
+    }
+    queue_condition_.notify_one();
+    return result;
+  }
+
+  size_t size() const { return workers_.size(); }
+
+ private:
+  void workerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_condition_.wait(
+            lock, [this] { return shutdown_requested_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          // Only exit once all remaining tasks are done.
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  bool shutdown_requested_ = false;
+  std::mutex queue_mutex_;
+  std::condition_variable queue_condition_;
+};
+
+}  // namespace glocal_exploration
+
+#endif  // GLOCAL_EXPLORATION_UTILS_THREAD_POOL_H_
@@ -5,6 +5,15 @@
 
 namespace glocal_exploration {
 
+void MapBase::areObservedInGlobalMap(const std::vector<Point>& positions,
+                                     std::vector<bool>* is_observed) {
+  CHECK_NOTNULL(is_observed);
+  is_observed->resize(positions.size());
+  for (size_t i = 0u; i < positions.size(); ++i) {
+    (*is_observed)[i] = isObservedInGlobalMap(positions[i]);
+  }
+}
+
 bool MapBase::findNearbyTraversablePoint(
     const FloatingPoint traversability_radius, Point* position) const {
   CHECK_NOTNULL(position);
@@ -0,0 +1,179 @@
+#include "glocal_exploration/planning/global/frontier_candidates.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace glocal_exploration {
+
+FrontierCandidates::FrontierCandidates(const std::vector<Point>& candidates,
+                                       FloatingPoint voxel_size)
+    : voxel_size_(voxel_size), num_candidates_(candidates.size()) {
+  CHECK_GT(voxel_size_, 0.f);
+  const FloatingPoint voxel_size_inv = 1.f / voxel_size_;
+  std::vector<voxblox::GlobalIndex> indices;
+  indices.reserve(candidates.size());
+  for (const Point& candidate : candidates) {
+    indices.push_back(voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(
+        candidate, voxel_size_inv));
+  }
+  if (indices.empty()) {
+    return;
+  }
+
+  // Store the indices relative to their minimum, s.t. the candidates only
+  // need wide storage if they span more voxels than fit into uint16.
+  min_index_ = indices.front();
+  voxblox::GlobalIndex max_index = indices.front();
+  for (const voxblox::GlobalIndex& index : indices) {
+    min_index_ = min_index_.cwiseMin(index);
+    max_index = max_index.cwiseMax(index);
+  }
+  uses_wide_indices_ = (max_index - min_index_).maxCoeff() >
+                       std::numeric_limits<uint16_t>::max();
+  resizeIndices(3 * indices.size());
+  for (size_t i = 0u; i < indices.size(); ++i) {
+    const voxblox::GlobalIndex relative_index = indices[i] - min_index_;
+    for (int j = 0; j < 3; ++j) {
+      if (uses_wide_indices_) {
+        wide_indices_[3 * i + j] = static_cast<int32_t>(relative_index[j]);
+      } else {
+        packed_indices_[3 * i + j] = static_cast<uint16_t>(relative_index[j]);
+      }
+    }
+  }
+}
+
+FrontierCandidates::~FrontierCandidates() { removeSpillFile(); }
+
+FrontierCandidates::FrontierCandidates(FrontierCandidates&& other) noexcept
+    : voxel_size_(other.voxel_size_),
+      num_candidates_(other.num_candidates_),
+      min_index_(other.min_index_),
+      uses_wide_indices_(other.uses_wide_indices_),
+      packed_indices_(std::move(other.packed_indices_)),
+      wide_indices_(std::move(other.wide_indices_)),
+      spill_file_path_(std::move(other.spill_file_path_)) {
+  other.spill_file_path_.clear();
+}
+
+FrontierCandidates& FrontierCandidates::operator=(
+    FrontierCandidates&& other) noexcept {
+  if (this != &other) {
+    removeSpillFile();
+    voxel_size_ = other.voxel_size_;
+    num_candidates_ = other.num_candidates_;
+    min_index_ = other.min_index_;
+    uses_wide_indices_ = other.uses_wide_indices_;
+    packed_indices_ = std::move(other.packed_indices_);
+    wide_indices_ = std::move(other.wide_indices_);
+    spill_file_path_ = std::move(other.spill_file_path_);
+    other.spill_file_path_.clear();
+  }
+  return *this;
+}
+
+std::vector<Point> FrontierCandidates::getPoints() {
+  if (isSpilled() && !loadFromFile()) {
+    return std::vector<Point>();
+  }
+  std::vector<Point> points;
+  points.reserve(num_candidates_);
+  for (size_t i = 0u; i < num_candidates_; ++i) {
+    voxblox::GlobalIndex index = min_index_;
+    for (int j = 0; j < 3; ++j) {
+      index[j] += uses_wide_indices_ ? wide_indices_[3 * i + j]
+                                     : packed_indices_[3 * i + j];
+    }
+    points.emplace_back(
+        voxblox::getCenterPointFromGridIndex(index, voxel_size_));
+  }
+  return points;
+}
+
+bool FrontierCandidates::spillToFile(const std::string& file_path) {
+  if (isSpilled()) {
+    return true;
+  }
+  // Only release the candidates once the file reads back identically.
+  bool is_verified = false;
+  {
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    file.write(indexData(), indexDataSize());
+    file.close();
+    if (file) {
+      std::vector<char> written(indexDataSize());
+      std::ifstream check_file(file_path, std::ios::binary);
+      is_verified =
+          check_file.read(written.data(), written.size()) &&
+          std::equal(written.begin(), written.end(), indexData());
+    }
+  }
+  if (!is_verified) {
+    LOG(WARNING) << "Could not spill frontier candidates to '" << file_path
+                 << "', keeping them in memory.";
+    std::remove(file_path.c_str());
+    return false;
+  }
+  spill_file_path_ = file_path;
+  releaseIndices();
+  return true;
+}
+
+bool FrontierCandidates::loadFromFile() {
+  if (!isSpilled()) {
+    return true;
+  }
+  resizeIndices(3 * num_candidates_);
+  std::ifstream file(spill_file_path_, std::ios::binary);
+  if (!file.read(indexData(), indexDataSize())) {
+    LOG(ERROR) << "Could not load spilled frontier candidates from '"
+               << spill_file_path_ << "'.";
+    file.close();
+    releaseIndices();
+    removeSpillFile();
+    num_candidates_ = 0u;
+    return false;
+  }
+  file.close();
+  removeSpillFile();
+  return true;
+}
+
+char* FrontierCandidates::indexData() {
+  return uses_wide_indices_ ? reinterpret_cast<char*>(wide_indices_.data())
+                            : reinterpret_cast<char*>(packed_indices_.data());
+}
+
+size_t FrontierCandidates::indexDataSize() const {
+  return uses_wide_indices_ ? wide_indices_.size() * sizeof(int32_t)
+                            : packed_indices_.size() * sizeof(uint16_t);
+}
+
+void FrontierCandidates::resizeIndices(size_t size) {
+  if (uses_wide_indices_) {
+    wide_indices_.resize(size);
+  } else {
+    packed_indices_.resize(size);
+  }
+}
+
+void FrontierCandidates::releaseIndices() {
+  packed_indices_.clear();
+  packed_indices_.shrink_to_fit();
+  wide_indices_.clear();
+  wide_indices_.shrink_to_fit();
+}
+
+void FrontierCandidates::removeSpillFile() {
+  if (isSpilled()) {
+    std::remove(spill_file_path_.c_str());
+    spill_file_path_.clear();
+  }
+}
+
+}  // namespace glocal_exploration
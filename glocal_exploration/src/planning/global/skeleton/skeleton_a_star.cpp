@@ -1,14 +1,16 @@
 #include "glocal_exploration/planning/global/skeleton/skeleton_a_star.h"
 
-#include <limits>
-#include <list>
-#include <map>
-#include <set>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "glocal_exploration/utils/execute_on_scope_exit.h"
+#include "glocal_exploration/utils/indexed_priority_queue.h"
 
 namespace glocal_exploration {
 
@@ -24,7 +26,11 @@ void SkeletonAStar::Config::checkParams() const {
                "linking_num_nearest_neighbors");
   checkParamGT(linking_max_num_submaps, 0, "linking_max_num_submaps");
   checkParamGT(linking_max_distance, 0.f, "linking_max_distance");
+  checkParamGE(relink_pose_tolerance, 0.f, "relink_pose_tolerance");
   checkParamGT(max_num_a_star_iterations, 0, "max_num_a_star_iterations");
+  checkParamGT(max_num_dijkstra_iterations, 0, "max_num_dijkstra_iterations");
+  checkParamGT(num_skeleton_generation_threads, 0,
+               "num_skeleton_generation_threads");
 }
 
 void SkeletonAStar::Config::fromRosParam() {
@@ -34,7 +40,13 @@ void SkeletonAStar::Config::fromRosParam() {
   rosParam("linking_num_nearest_neighbors", &linking_num_nearest_neighbors);
   rosParam("linking_max_num_submaps", &linking_max_num_submaps);
   rosParam("linking_max_distance", &linking_max_distance);
+  rosParam("relink_pose_tolerance", &relink_pose_tolerance);
   rosParam("max_num_a_star_iterations", &max_num_a_star_iterations);
+  rosParam("max_num_dijkstra_iterations", &max_num_dijkstra_iterations);
+  rosParam("cache_edge_traversability", &cache_edge_traversability);
+  rosParam("num_skeleton_generation_threads",
+           &num_skeleton_generation_threads);
+  rosParam("use_hierarchical_search", &use_hierarchical_search);
 }
 
 void SkeletonAStar::Config::printFields() const {
@@ -45,11 +57,19 @@ void SkeletonAStar::Config::printFields() const {
   printField("linking_num_nearest_neighbors", linking_num_nearest_neighbors);
   printField("linking_max_num_submaps", linking_max_num_submaps);
   printField("linking_max_distance", linking_max_distance);
+  printField("relink_pose_tolerance", relink_pose_tolerance);
   printField("max_num_a_star_iterations", max_num_a_star_iterations);
+  printField("max_num_dijkstra_iterations", max_num_dijkstra_iterations);
+  printField("cache_edge_traversability", cache_edge_traversability);
+  printField("num_skeleton_generation_threads",
+             num_skeleton_generation_threads);
+  printField("use_hierarchical_search", use_hierarchical_search);
 }
 
 bool SkeletonAStar::planPath(const Point& start_point, const Point& goal_point,
                              std::vector<RelativeWayPoint>* way_points) {
+  updateLinkLayer();
+
   // Search the nearest reachable start vertex on the skeleton graphs
   if (!comm_->map()->isTraversableInActiveSubmap(
           start_point, config_.traversability_radius)) {
@@ -61,7 +81,8 @@ bool SkeletonAStar::planPath(const Point& start_point, const Point& goal_point,
   const std::vector<GlobalVertexId> start_vertex_candidates =
       searchClosestReachableSkeletonVertices(
           start_point, config_.max_num_start_vertex_candidates,
-          [this](const Point& start_point, const Point& end_point) {
+          [this](const Point& start_point, const GlobalVertexId&,
+                 const Point& end_point) {
             return comm_->map()->isLineTraversableInActiveSubmap(
                 start_point, end_point, config_.traversability_radius);
           });
@@ -83,7 +104,8 @@ bool SkeletonAStar::planPath(const Point& start_point, const Point& goal_point,
   std::vector<GlobalVertexId> end_vertex_candidates =
       searchClosestReachableSkeletonVertices(
           goal_point, config_.max_num_end_vertex_candidates,
-          [this](const Point& start_point, const Point& end_point) {
+          [this](const Point& start_point, const GlobalVertexId&,
+                 const Point& end_point) {
             return comm_->map()->isLineTraversableInGlobalMap(
                 start_point, end_point, config_.traversability_radius);
           });
@@ -113,50 +135,86 @@ bool SkeletonAStar::planPath(const Point& start_point, const Point& goal_point,
 std::vector<GlobalVertexId>
 SkeletonAStar::searchClosestReachableSkeletonVertices(
     const Point& point, const int n_closest,
-    const std::function<bool(const Point& point,
-                             const Point& skeleton_vertex_point)>&
-        traversability_function) const {
-  struct CandidateVertex {
-    GlobalVertexId global_vertex_id;
-    Point t_O_point = Point::Zero();
-    float distance = -1.f;
+    const VertexTraversabilityFunction& traversability_function) const {
+  // Each overlapping submap provides a stream of its vertices in order of
+  // increasing distance, queried from its kd-tree in growing batches. The
+  // streams are merged with a heap, s.t. only as many vertices are visited as
+  // needed to find the n_closest reachable ones.
+  // NOTE: The submap poses are rigid, so the distances computed in submap
+  //       frame are equal to the ones in odom frame.
+  struct NearestVertexStream {
+    SkeletonSubmap::ConstPtr submap;
+    Point t_submap_point;
+    std::vector<VertexIdElement> vertex_ids;
+    size_t next_index = 0u;
+    bool is_exhausted = false;
+  };
+  struct StreamHead {
+    FloatingPoint distance;
+    size_t stream_index;
+    bool operator>(const StreamHead& other) const {
+      return distance > other.distance;
+    }
+  };
+  std::vector<NearestVertexStream> streams;
+  std::priority_queue<StreamHead, std::vector<StreamHead>,
+                      std::greater<StreamHead>>
+      stream_heads;
+  auto push_stream_head = [&](const size_t stream_index) {
+    NearestVertexStream& stream = streams[stream_index];
+    if (stream.next_index == stream.vertex_ids.size() && !stream.is_exhausted) {
+      // Fetch the next batch, doubling its size to bound the number of
+      // queries. The already returned vertices are skipped.
+      const size_t num_vertices = stream.submap->getNumVertices();
+      const size_t num_requested = std::min(
+          num_vertices, std::max(static_cast<size_t>(n_closest),
+                                 2u * stream.vertex_ids.size()));
+      if (num_requested > stream.vertex_ids.size()) {
+        stream.submap->getNClosestVertices(stream.t_submap_point,
+                                           num_requested, &stream.vertex_ids);
+      }
+      stream.is_exhausted = stream.vertex_ids.size() < num_requested ||
+                            num_requested == num_vertices;
+    }
+    if (stream.next_index < stream.vertex_ids.size()) {
+      const Point& t_submap_vertex =
+          stream.submap->getVertexPoint(stream.vertex_ids[stream.next_index]);
+      stream_heads.push(StreamHead{
+          (t_submap_vertex - stream.t_submap_point).norm(), stream_index});
+    }
   };
-  std::list<CandidateVertex> candidate_start_vertices;
   for (const SubmapId submap_id : comm_->map()->getSubmapIdsAtPosition(point)) {
     SkeletonSubmap::ConstPtr skeleton_submap =
         skeleton_submap_collection_.getSubmapConstPtrById(submap_id);
     if (!skeleton_submap) {
-      LOG(ERROR) << "Couldn't get pointer to skeleton submap with ID "
-                 << submap_id;
+      // The skeleton of the submap is still being generated.
       continue;
     }
-    for (const auto& vertex_kv :
-         skeleton_submap->getSkeletonGraph().getVertexMap()) {
-      CandidateVertex candidate_vertex;
-      candidate_vertex.global_vertex_id.submap_id = submap_id;
-      candidate_vertex.global_vertex_id.vertex_id = vertex_kv.second.vertex_id;
-      candidate_vertex.t_O_point =
-          skeleton_submap->getPose() * vertex_kv.second.point;
-      candidate_vertex.distance = (candidate_vertex.t_O_point - point).norm();
-      candidate_start_vertices.emplace_back(std::move(candidate_vertex));
-    }
+    NearestVertexStream stream;
+    stream.t_submap_point = skeleton_submap->getPose().inverse() * point;
+    stream.submap = std::move(skeleton_submap);
+    streams.emplace_back(std::move(stream));
+    push_stream_head(streams.size() - 1u);
   }
 
-  candidate_start_vertices.sort(
-      [](const CandidateVertex& lhs, const CandidateVertex& rhs) {
-        return lhs.distance < rhs.distance;
-      });
-
   int num_candidates_unreachable = 0;
   std::vector<GlobalVertexId> reachable_skeleton_vertices;
-  for (const CandidateVertex& candidate_start_vertex :
-       candidate_start_vertices) {
-    if (traversability_function(point, candidate_start_vertex.t_O_point)) {
-      reachable_skeleton_vertices.emplace_back(
-          candidate_start_vertex.global_vertex_id);
-      if (n_closest <= reachable_skeleton_vertices.size()) {
-        break;
-      }
+  while (!stream_heads.empty() &&
+         reachable_skeleton_vertices.size() < n_closest) {
+    const size_t stream_index = stream_heads.top().stream_index;
+    stream_heads.pop();
+    NearestVertexStream& stream = streams[stream_index];
+    const GlobalVertexId candidate_vertex_id{
+        stream.submap->getId(), stream.vertex_ids[stream.next_index]};
+    const Point t_O_candidate_vertex =
+        stream.submap->getPose() *
+        stream.submap->getVertexPoint(candidate_vertex_id.vertex_id);
+    ++stream.next_index;
+    push_stream_head(stream_index);
+
+    if (traversability_function(point, candidate_vertex_id,
+                                t_O_candidate_vertex)) {
+      reachable_skeleton_vertices.emplace_back(candidate_vertex_id);
     } else {
       ++num_candidates_unreachable;
     }
@@ -173,40 +231,115 @@ bool SkeletonAStar::getPathBetweenVertices(
   CHECK_NOTNULL(vertex_path);
   CHECK(!start_vertex_candidates.empty());
   CHECK(!end_vertex_candidates.empty());
+  const auto t_start = std::chrono::high_resolution_clock::now();
+
+  // Publish the statistics of all search passes once this method returns.
+  SearchStatistics statistics;
+  ExecuteOnScopeExit auto_copy_statistics([&]() {
+    statistics.search_time_ms =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - t_start)
+            .count();
+    std::lock_guard<std::mutex> lock_guard(visualization_data_mutex_);
+    last_search_statistics_ = statistics;
+  });
 
-  std::map<GlobalVertexId, FloatingPoint> g_score_map;
-  std::map<GlobalVertexId, FloatingPoint> f_score_map;
-  std::map<GlobalVertexId, GlobalVertexId> parent_map;
+  // Try to find the path within the corridor of submaps found on the portal
+  // layer first, s.t. the search does not expand the whole map.
+  if (config_.use_hierarchical_search) {
+    std::unordered_set<SubmapId> corridor;
+    const bool found_corridor =
+        searchSubmapCorridor(start_vertex_candidates, end_vertex_candidates,
+                             start_point, goal_point, &corridor, &statistics);
+    statistics.num_corridor_submaps = corridor.size();
+    if (searchPathBetweenVertices(start_vertex_candidates,
+                                  end_vertex_candidates, start_point,
+                                  goal_point, &corridor, vertex_path,
+                                  &statistics)) {
+      return true;
+    }
+    LOG(INFO) << "Could not find skeleton path within the corridor of "
+              << corridor.size() << " submaps"
+              << (found_corridor ? "" : " around the start and goal")
+              << ". Will search all submaps.";
+    statistics.used_fallback_search = true;
+  }
+  return searchPathBetweenVertices(start_vertex_candidates,
+                                   end_vertex_candidates, start_point,
+                                   goal_point, nullptr, vertex_path,
+                                   &statistics);
+}
 
-  std::set<GlobalVertexId> open_set;
-  std::set<GlobalVertexId> closed_set;
+bool SkeletonAStar::searchPathBetweenVertices(
+    const std::vector<GlobalVertexId>& start_vertex_candidates,
+    const std::vector<GlobalVertexId>& end_vertex_candidates,
+    const Point& start_point, const Point& goal_point,
+    const std::unordered_set<SubmapId>* corridor,
+    std::vector<GlobalVertexId>* vertex_path,
+    SearchStatistics* statistics) const {
+  CHECK_NOTNULL(statistics);
+
+  // NOTE: The f-scores are only stored in the open set, where they can be
+  //       decreased in place.
+  std::unordered_map<GlobalVertexId, FloatingPoint, GlobalVertexIdHash>
+      g_score_map;
+  VertexIdMap parent_map;
+  IndexedPriorityQueue<GlobalVertexId, FloatingPoint, GlobalVertexIdHash>
+      open_set;
+  VertexIdSet closed_set;
 
-  // Auto copy the visualization data once this method returns.
+  // Auto copy the visualization data once this method returns and add the
+  // counts of this pass to the statistics.
   // NOTE: We copy them s.t. it's safe to read them from a separate thread.
-  std::map<GlobalVertexId, GlobalVertexId> intraversable_edge_map;
+  VertexIdMap intraversable_edge_map;
+  size_t iteration_counter = 0u;
   ExecuteOnScopeExit auto_copy_visuals([&]() {
+    statistics->num_iterations += iteration_counter;
+    statistics->num_queued_vertices += g_score_map.size();
     std::lock_guard<std::mutex> lock_guard(visualization_data_mutex_);
-    visualization_edges_.parent_map_ = parent_map;
-    visualization_edges_.intraversable_edge_map_ = intraversable_edge_map;
+    visualization_edges_.parent_map_ = std::move(parent_map);
+    visualization_edges_.intraversable_edge_map_ =
+        std::move(intraversable_edge_map);
   });
 
+  // Queue the vertex if it was not reached yet or can be reached more
+  // cheaply through the parent vertex.
+  auto update_vertex = [&](const GlobalVertexId& vertex_id,
+                           const GlobalVertexId& parent_vertex_id,
+                           FloatingPoint tentative_g_score,
+                           FloatingPoint heuristic) {
+    if (corridor && !(vertex_id == kGoalVertexId) &&
+        corridor->count(vertex_id.submap_id) == 0) {
+      return;
+    }
+    auto it = g_score_map.find(vertex_id);
+    if (it != g_score_map.end() && it->second <= tentative_g_score) {
+      return;
+    }
+    g_score_map[vertex_id] = tentative_g_score;
+    parent_map[vertex_id] = parent_vertex_id;
+    open_set.pushOrDecrease(vertex_id, tentative_g_score + heuristic);
+  };
+
   // Initialize the search with vertices that can be used as graph entry points
   // i.e. vertices that are closest to the start_point and reachable
   for (const GlobalVertexId& current_vertex_id : start_vertex_candidates) {
+    if (corridor && corridor->count(current_vertex_id.submap_id) == 0) {
+      continue;
+    }
     const SkeletonSubmap& current_submap =
         skeleton_submap_collection_.getSubmapById(current_vertex_id.submap_id);
-    const voxblox::SparseSkeletonGraph& current_graph =
-        current_submap.getSkeletonGraph();
-    const voxblox::SkeletonVertex& current_vertex =
-        current_graph.getVertex(current_vertex_id.vertex_id);
-
     const voxblox::Point t_odom_current_vertex =
-        current_submap.getPose() * current_vertex.point;
-    g_score_map[current_vertex_id] =
-        (t_odom_current_vertex - start_point).norm();
-    f_score_map[current_vertex_id] =
-        (goal_point - t_odom_current_vertex).norm();
-    open_set.insert(current_vertex_id);
+        current_submap.getPose() *
+        current_submap.getVertexPoint(current_vertex_id.vertex_id);
+    const FloatingPoint g_score = (t_odom_current_vertex - start_point).norm();
+    auto it = g_score_map.find(current_vertex_id);
+    if (it == g_score_map.end() || g_score < it->second) {
+      g_score_map[current_vertex_id] = g_score;
+      open_set.pushOrDecrease(
+          current_vertex_id,
+          g_score + (goal_point - t_odom_current_vertex).norm());
+    }
   }
 
   // Indicate which vertices can be used as graph exit points
@@ -218,10 +351,8 @@ bool SkeletonAStar::getPathBetweenVertices(
   }
 
   // Run the Astar search
-  size_t iteration_counter = 0u;
   SubmapId previous_submap_id = -1;
   const SkeletonSubmap* current_submap = nullptr;
-  const voxblox::SparseSkeletonGraph* current_graph = nullptr;
   while (!open_set.empty()) {
     if (config_.max_num_a_star_iterations <= ++iteration_counter) {
       LOG(WARNING) << "Aborting skeleton planning. Exceeded maximum number of "
@@ -230,175 +361,720 @@ bool SkeletonAStar::getPathBetweenVertices(
       return false;
     }
 
-    // Find the smallest f-value in the open set.
-    const GlobalVertexId current_vertex_id =
-        popSmallestFromOpen(f_score_map, &open_set);
+    // Get the vertex with the smallest f-value in the open set.
+    const GlobalVertexId current_vertex_id = open_set.pop();
 
     // Check if we have reached the goal
     if (current_vertex_id == kGoalVertexId) {
+      statistics->found_path = true;
       LOG(INFO) << "Found skeleton path to goal in " << iteration_counter
                 << " iterations.";
       getSolutionVertexPath(kGoalVertexId, parent_map, vertex_path);
       return true;
     }
 
-    // Get vertex's submap and graph
+    // Get vertex's submap
     if (current_vertex_id.submap_id != previous_submap_id) {
       current_submap = &skeleton_submap_collection_.getSubmapById(
           current_vertex_id.submap_id);
-      current_graph = &current_submap->getSkeletonGraph();
     }
     previous_submap_id = current_vertex_id.submap_id;
     closed_set.insert(current_vertex_id);
+    ++statistics->num_expanded_vertices;
+    const FloatingPoint current_g_score = g_score_map.at(current_vertex_id);
 
     // If this vertex is an exit point candidate,
     // hallucinate an edge to the goal
-    const voxblox::SkeletonVertex& current_vertex =
-        current_graph->getVertex(current_vertex_id.vertex_id);
     if (end_vertex_candidate_set.count(current_vertex_id)) {
-      //      LOG(WARNING) << "Found exit point candidate vertex";
-      if (open_set.count(kGoalVertexId) == 0) {
-        open_set.insert(kGoalVertexId);
-      }
-      FloatingPoint tentative_g_score =
-          g_score_map[current_vertex_id] +
-          (goal_point - current_vertex.point).norm();
-      if (g_score_map.count(kGoalVertexId) == 0 ||
-          g_score_map[kGoalVertexId] < tentative_g_score) {
-        g_score_map[kGoalVertexId] = tentative_g_score;
-        f_score_map[kGoalVertexId] = tentative_g_score;
-        parent_map[kGoalVertexId] = current_vertex_id;
-      }
+      const Point t_odom_current_vertex =
+          current_submap->getPose() *
+          current_submap->getVertexPoint(current_vertex_id.vertex_id);
+      update_vertex(kGoalVertexId, current_vertex_id,
+                    current_g_score +
+                        (goal_point - t_odom_current_vertex).norm(),
+                    0.f);
       continue;
     }
 
-    // Unless this vertex already has many neighbors, try to connect to a
-    // neighboring skeleton submap
-    const Point t_odom_current_vertex =
-        current_submap->getPose() * current_vertex.point;
-    if (current_vertex.edge_list.size() <= 3) {
-      int num_linked_submaps = 0;
-      int num_links_total = 0;
-      for (const SubmapId submap_id :
-           comm_->map()->getSubmapIdsAtPosition(t_odom_current_vertex)) {
-        // Avoid linking the current vertex against vertices of its own submap
-        if (submap_id == current_vertex_id.submap_id) {
-          continue;
-        }
+    // Evaluate the vertex's neighbors
+    expandVertex(current_vertex_id, *current_submap, closed_set,
+                 &intraversable_edge_map, statistics,
+                 [&](const GlobalVertexId& neighbor_vertex_id,
+                     const Point& t_odom_neighbor_vertex,
+                     FloatingPoint edge_length) {
+                   update_vertex(neighbor_vertex_id, current_vertex_id,
+                                 current_g_score + edge_length,
+                                 (goal_point - t_odom_neighbor_vertex).norm());
+                 });
+  }
 
-        SkeletonSubmap::ConstPtr nearby_submap =
-            skeleton_submap_collection_.getSubmapConstPtrById(submap_id);
-        if (!nearby_submap) {
-          continue;
+  return false;
+}
+
+bool SkeletonAStar::searchSubmapCorridor(
+    const std::vector<GlobalVertexId>& start_vertex_candidates,
+    const std::vector<GlobalVertexId>& end_vertex_candidates,
+    const Point& start_point, const Point& goal_point,
+    std::unordered_set<SubmapId>* corridor,
+    SearchStatistics* statistics) const {
+  CHECK_NOTNULL(corridor);
+  CHECK_NOTNULL(statistics);
+  corridor->clear();
+
+  // The paths between the start or end vertices and the portals are not part
+  // of the portal layer, so their submaps are always included.
+  std::unordered_map<SubmapId, std::vector<GlobalVertexId>>
+      end_vertex_candidates_by_submap;
+  for (const GlobalVertexId& start_vertex_id : start_vertex_candidates) {
+    corridor->insert(start_vertex_id.submap_id);
+  }
+  for (const GlobalVertexId& end_vertex_id : end_vertex_candidates) {
+    corridor->insert(end_vertex_id.submap_id);
+    end_vertex_candidates_by_submap[end_vertex_id.submap_id].push_back(
+        end_vertex_id);
+  }
+
+  auto get_odom_position = [&](const GlobalVertexId& vertex_id) -> Point {
+    const SkeletonSubmap& submap =
+        skeleton_submap_collection_.getSubmapById(vertex_id.submap_id);
+    return submap.getPose() * submap.getVertexPoint(vertex_id.vertex_id);
+  };
+  auto get_portals = [&](const SubmapId submap_id)
+      -> const std::unordered_map<VertexIdElement, Portal>* {
+    auto it = submap_portals_.find(submap_id);
+    return it == submap_portals_.end() ? nullptr : &it->second;
+  };
+
+  // A* search over the portals, where the nodes are the portal vertices.
+  std::unordered_map<GlobalVertexId, FloatingPoint, GlobalVertexIdHash>
+      g_score_map;
+  VertexIdMap parent_map;
+  IndexedPriorityQueue<GlobalVertexId, FloatingPoint, GlobalVertexIdHash>
+      open_set;
+  VertexIdSet closed_set;
+  auto update_node = [&](const GlobalVertexId& node_id,
+                         const GlobalVertexId& parent_node_id,
+                         FloatingPoint tentative_g_score) {
+    if (closed_set.count(node_id)) {
+      return;
+    }
+    auto it = g_score_map.find(node_id);
+    if (it != g_score_map.end() && it->second <= tentative_g_score) {
+      return;
+    }
+    g_score_map[node_id] = tentative_g_score;
+    parent_map[node_id] = parent_node_id;
+    const FloatingPoint heuristic =
+        node_id == kGoalVertexId
+            ? 0.f
+            : (goal_point - get_odom_position(node_id)).norm();
+    open_set.pushOrDecrease(node_id, tentative_g_score + heuristic);
+  };
+
+  // Enter the portal layer through the portals of the start submaps.
+  for (const GlobalVertexId& start_vertex_id : start_vertex_candidates) {
+    const auto* portals = get_portals(start_vertex_id.submap_id);
+    if (!portals) {
+      continue;
+    }
+    const FloatingPoint start_distance =
+        (get_odom_position(start_vertex_id) - start_point).norm();
+    for (const auto& portal_kv : *portals) {
+      const Portal& portal = portal_kv.second;
+      auto distance_it =
+          portal.vertex_distances.find(start_vertex_id.vertex_id);
+      if (distance_it != portal.vertex_distances.end()) {
+        update_node(portal.vertex_id, start_vertex_id,
+                    start_distance + distance_it->second);
+      }
+    }
+  }
+
+  size_t& num_iterations = statistics->num_portal_iterations;
+  while (!open_set.empty()) {
+    if (config_.max_num_a_star_iterations <= ++num_iterations) {
+      LOG(WARNING) << "Aborting portal search. Exceeded maximum number of "
+                      "iterations ("
+                   << num_iterations << ").";
+      return false;
+    }
+    const GlobalVertexId current_node_id = open_set.pop();
+    if (current_node_id == kGoalVertexId) {
+      std::vector<GlobalVertexId> node_path;
+      getSolutionVertexPath(kGoalVertexId, parent_map, &node_path);
+      for (const GlobalVertexId& node_id : node_path) {
+        if (!(node_id == kGoalVertexId)) {
+          corridor->insert(node_id.submap_id);
         }
+      }
+      return true;
+    }
+    closed_set.insert(current_node_id);
+    const FloatingPoint current_g_score = g_score_map.at(current_node_id);
+    const auto& submap_portals = *get_portals(current_node_id.submap_id);
+    const Portal& current_portal =
+        submap_portals.at(current_node_id.vertex_id);
 
-        // Limit the maximum number of submaps that can be linked to
-        if (config_.linking_max_num_submaps < num_linked_submaps ||
-            config_.linking_max_num_links < num_links_total) {
-          break;
+    // Exit to the goal through the end vertices of the portal's submap.
+    auto end_it = end_vertex_candidates_by_submap.find(
+        current_node_id.submap_id);
+    if (end_it != end_vertex_candidates_by_submap.end()) {
+      for (const GlobalVertexId& end_vertex_id : end_it->second) {
+        auto distance_it =
+            current_portal.vertex_distances.find(end_vertex_id.vertex_id);
+        if (distance_it != current_portal.vertex_distances.end()) {
+          update_node(
+              kGoalVertexId, current_node_id,
+              current_g_score + distance_it->second +
+                  (goal_point - get_odom_position(end_vertex_id)).norm());
         }
+      }
+    }
+
+    // Move to the other portals of the same submap.
+    for (const auto& portal_kv : submap_portals) {
+      const Portal& portal = portal_kv.second;
+      auto distance_it =
+          portal.vertex_distances.find(current_node_id.vertex_id);
+      if (distance_it != portal.vertex_distances.end()) {
+        update_node(portal.vertex_id, current_node_id,
+                    current_g_score + distance_it->second);
+      }
+    }
 
-        voxblox::Point t_nearby_submap_current_vertex =
-            (nearby_submap->getPose().inverse() * t_odom_current_vertex);
-        std::vector<VertexIdElement> nearest_vertex_ids;
-        nearby_submap->getNClosestVertices(
-            t_nearby_submap_current_vertex,
-            config_.linking_num_nearest_neighbors, &nearest_vertex_ids);
-
-        bool linked_submap = false;
-        for (const VertexIdElement& nearby_vertex_id : nearest_vertex_ids) {
-          const GlobalVertexId nearby_vertex_global_id{submap_id,
-                                                       nearby_vertex_id};
-          const Point t_odom_nearby_vertex =
-              nearby_submap->getPose() * nearby_submap->getSkeletonGraph()
-                                             .getVertex(nearby_vertex_id)
-                                             .point;
-          const float distance_current_to_nearby_vertex =
-              (t_odom_current_vertex - t_odom_nearby_vertex).norm();
-          if (distance_current_to_nearby_vertex <
-              config_.linking_max_distance) {
-            if (comm_->map()->isLineTraversableInGlobalMap(
-                    t_odom_current_vertex, t_odom_nearby_vertex,
-                    config_.traversability_radius)) {
-              ++num_links_total;
-              linked_submap = true;
-              if (closed_set.count(nearby_vertex_global_id) > 0) {
-                continue;
-              }
-              if (open_set.count(nearby_vertex_global_id) == 0) {
-                open_set.insert(nearby_vertex_global_id);
-              }
-
-              FloatingPoint tentative_g_score =
-                  g_score_map[current_vertex_id] +
-                  (t_odom_nearby_vertex - t_odom_current_vertex).norm();
-              if (g_score_map.count(nearby_vertex_global_id) == 0 ||
-                  g_score_map[nearby_vertex_global_id] < tentative_g_score) {
-                g_score_map[nearby_vertex_global_id] = tentative_g_score;
-                f_score_map[nearby_vertex_global_id] =
-                    tentative_g_score +
-                    (goal_point - t_odom_nearby_vertex).norm();
-                parent_map[nearby_vertex_global_id] = current_vertex_id;
-              }
-            } else {
-              intraversable_edge_map[current_vertex_id] =
-                  nearby_vertex_global_id;
-            }
+    // Cross over to the portals of the neighboring submaps.
+    for (const InterSubmapLink& link : current_portal.links) {
+      const FloatingPoint link_g_score = current_g_score + link.length;
+      bool reached_target_portal = false;
+      const auto* target_portals = get_portals(link.target_vertex_id.submap_id);
+      if (target_portals) {
+        for (const auto& portal_kv : *target_portals) {
+          const Portal& portal = portal_kv.second;
+          auto distance_it =
+              portal.vertex_distances.find(link.target_vertex_id.vertex_id);
+          if (distance_it != portal.vertex_distances.end()) {
+            update_node(portal.vertex_id, current_node_id,
+                        link_g_score + distance_it->second);
+            reached_target_portal = true;
           }
         }
-        if (linked_submap) {
-          ++num_linked_submaps;
+      }
+
+      // Submaps without outgoing links have no portals, so the goal is exited
+      // to directly from the link's target vertex if it is in an end submap.
+      // NOTE: The distance to the end vertices along the skeleton is unknown,
+      //       so the straight line distance serves as lower bound.
+      auto target_end_it =
+          end_vertex_candidates_by_submap.find(link.target_vertex_id.submap_id);
+      if (reached_target_portal ||
+          target_end_it == end_vertex_candidates_by_submap.end()) {
+        continue;
+      }
+      for (const GlobalVertexId& end_vertex_id : target_end_it->second) {
+        const Point t_odom_end_vertex = get_odom_position(end_vertex_id);
+        update_node(kGoalVertexId, current_node_id,
+                    link_g_score +
+                        (t_odom_end_vertex - link.t_odom_target_vertex).norm() +
+                        (goal_point - t_odom_end_vertex).norm());
+      }
+    }
+  }
+  return false;
+}
+
+void SkeletonAStar::getPathsToGoals(
+    const std::vector<GlobalVertexId>& start_vertex_candidates,
+    const Point& start_point, const std::vector<Goal>& goals,
+    std::vector<GoalPath>* goal_paths) const {
+  CHECK_NOTNULL(goal_paths);
+  CHECK(!start_vertex_candidates.empty());
+  const auto t_start = std::chrono::high_resolution_clock::now();
+  goal_paths->clear();
+  goal_paths->resize(goals.size());
+
+  // Dijkstra search from the start vertices. Contrary to A* there is no
+  // heuristic, s.t. the vertices are settled in order of their exact path
+  // length and the search serves all goals at once.
+  std::unordered_map<GlobalVertexId, FloatingPoint, GlobalVertexIdHash>
+      g_score_map;
+  VertexIdMap parent_map;
+  IndexedPriorityQueue<GlobalVertexId, FloatingPoint, GlobalVertexIdHash>
+      open_set;
+  VertexIdSet closed_set;
+
+  // Auto copy the visualization data and statistics once this method returns.
+  VertexIdMap intraversable_edge_map;
+  SearchStatistics statistics;
+  ExecuteOnScopeExit auto_copy_visuals([&]() {
+    statistics.num_queued_vertices = g_score_map.size();
+    statistics.search_time_ms =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - t_start)
+            .count();
+    std::lock_guard<std::mutex> lock_guard(visualization_data_mutex_);
+    visualization_edges_.parent_map_ = std::move(parent_map);
+    visualization_edges_.intraversable_edge_map_ =
+        std::move(intraversable_edge_map);
+    last_search_statistics_ = statistics;
+  });
+
+  // Index which goals each exit vertex candidate leads to.
+  std::unordered_map<GlobalVertexId, std::vector<size_t>, GlobalVertexIdHash>
+      exit_vertex_goals;
+  for (size_t goal_index = 0u; goal_index < goals.size(); ++goal_index) {
+    for (const GlobalVertexId& exit_vertex_id :
+         goals[goal_index].exit_vertex_candidates) {
+      exit_vertex_goals[exit_vertex_id].push_back(goal_index);
+    }
+  }
+  size_t num_unsettled_exit_vertices = exit_vertex_goals.size();
+
+  // Initialize the search with the graph entry points.
+  for (const GlobalVertexId& start_vertex_id : start_vertex_candidates) {
+    const SkeletonSubmap& start_submap =
+        skeleton_submap_collection_.getSubmapById(start_vertex_id.submap_id);
+    const FloatingPoint g_score =
+        (start_submap.getPose() *
+             start_submap.getVertexPoint(start_vertex_id.vertex_id) -
+         start_point)
+            .norm();
+    auto it = g_score_map.find(start_vertex_id);
+    if (it == g_score_map.end() || g_score < it->second) {
+      g_score_map[start_vertex_id] = g_score;
+      open_set.pushOrDecrease(start_vertex_id, g_score);
+    }
+  }
+
+  // Run the search until all exit vertex candidates are settled.
+  std::unordered_map<size_t, GlobalVertexId> best_exit_vertices;
+  while (!open_set.empty() && 0u < num_unsettled_exit_vertices) {
+    if (config_.max_num_dijkstra_iterations <= ++statistics.num_iterations) {
+      LOG(WARNING) << "Aborting multi-goal skeleton search. Exceeded maximum "
+                      "number of iterations ("
+                   << statistics.num_iterations << ").";
+      break;
+    }
+    const GlobalVertexId current_vertex_id = open_set.pop();
+    closed_set.insert(current_vertex_id);
+    ++statistics.num_expanded_vertices;
+    const FloatingPoint current_g_score = g_score_map.at(current_vertex_id);
+    const SkeletonSubmap& current_submap =
+        skeleton_submap_collection_.getSubmapById(current_vertex_id.submap_id);
+
+    // Complete the paths to the goals this vertex leads to.
+    auto exit_it = exit_vertex_goals.find(current_vertex_id);
+    if (exit_it != exit_vertex_goals.end()) {
+      --num_unsettled_exit_vertices;
+      const Point t_odom_current_vertex =
+          current_submap.getPose() *
+          current_submap.getVertexPoint(current_vertex_id.vertex_id);
+      for (const size_t goal_index : exit_it->second) {
+        const FloatingPoint path_length =
+            current_g_score +
+            (goals[goal_index].goal_point - t_odom_current_vertex).norm();
+        GoalPath& goal_path = (*goal_paths)[goal_index];
+        if (!goal_path.is_reachable || path_length < goal_path.path_length) {
+          goal_path.is_reachable = true;
+          goal_path.path_length = path_length;
+          best_exit_vertices[goal_index] = current_vertex_id;
         }
       }
     }
 
-    // Evaluate the vertex's neighbors
-    for (int64_t edge_id : current_vertex.edge_list) {
-      const voxblox::SkeletonEdge& edge = current_graph->getEdge(edge_id);
-      GlobalVertexId neighbor_vertex_id = current_vertex_id;
-      if (edge.start_vertex == current_vertex_id.vertex_id) {
-        neighbor_vertex_id.vertex_id = edge.end_vertex;
-      } else {
-        neighbor_vertex_id.vertex_id = edge.start_vertex;
+    expandVertex(current_vertex_id, current_submap, closed_set,
+                 &intraversable_edge_map, &statistics,
+                 [&](const GlobalVertexId& neighbor_vertex_id,
+                     const Point& /*t_odom_neighbor_vertex*/,
+                     FloatingPoint edge_length) {
+                   const FloatingPoint tentative_g_score =
+                       current_g_score + edge_length;
+                   auto it = g_score_map.find(neighbor_vertex_id);
+                   if (it != g_score_map.end() &&
+                       it->second <= tentative_g_score) {
+                     return;
+                   }
+                   g_score_map[neighbor_vertex_id] = tentative_g_score;
+                   parent_map[neighbor_vertex_id] = current_vertex_id;
+                   open_set.pushOrDecrease(neighbor_vertex_id,
+                                           tentative_g_score);
+                 });
+  }
+
+  // Extract the paths, ending in the goal.
+  for (const auto& goal_exit_vertex_kv : best_exit_vertices) {
+    std::vector<GlobalVertexId>& vertex_path =
+        (*goal_paths)[goal_exit_vertex_kv.first].vertex_path;
+    getSolutionVertexPath(goal_exit_vertex_kv.second, parent_map,
+                          &vertex_path);
+    vertex_path.push_back(kGoalVertexId);
+  }
+  statistics.found_path = !best_exit_vertices.empty();
+}
+
+void SkeletonAStar::expandVertex(const GlobalVertexId& vertex_id,
+                                 const SkeletonSubmap& submap,
+                                 const VertexIdSet& closed_set,
+                                 VertexIdMap* intraversable_edge_map,
+                                 SearchStatistics* statistics,
+                                 const NeighborFunction& function) const {
+  // Follow the precomputed links to neighboring skeleton submaps
+  auto links_it = inter_submap_links_.find(vertex_id);
+  if (links_it != inter_submap_links_.end()) {
+    for (const InterSubmapLink& link : links_it->second) {
+      if (closed_set.count(link.target_vertex_id) == 0) {
+        function(link.target_vertex_id, link.t_odom_target_vertex,
+                 link.length);
       }
+    }
+  }
+
+  // Follow the edges of the vertex's own skeleton graph
+  const Transformation T_odom_submap = submap.getPose();
+  const Point t_odom_vertex =
+      T_odom_submap * submap.getVertexPoint(vertex_id.vertex_id);
+  for (const SkeletonSubmap::Neighbor& neighbor :
+       submap.getNeighbors(vertex_id.vertex_id)) {
+    const GlobalVertexId neighbor_vertex_id{vertex_id.submap_id,
+                                            neighbor.vertex_id};
+    if (closed_set.count(neighbor_vertex_id) > 0) {
+      // This neighbor has already been checked
+      continue;
+    }
 
-      if (closed_set.count(neighbor_vertex_id) > 0) {
-        // This neighbor has already been checked
+    // Check if this neighbor is reachable from the current vertex
+    const Point t_odom_neighbor_vertex =
+        T_odom_submap * submap.getVertexPoint(neighbor.vertex_id);
+    if (!isEdgeTraversable(vertex_id, neighbor_vertex_id, t_odom_vertex,
+                           t_odom_neighbor_vertex, statistics)) {
+      (*intraversable_edge_map)[vertex_id] = neighbor_vertex_id;
+      continue;
+    }
+
+    // NOTE: The edge lengths are precomputed in submap frame.
+    function(neighbor_vertex_id, t_odom_neighbor_vertex, neighbor.edge_length);
+  }
+}
+
+void SkeletonAStar::updateLinkLayer() {
+  const auto t_start = std::chrono::high_resolution_clock::now();
+  skeleton_submap_collection_.collectFinishedSubmaps();
+
+  // Find the submaps that are new or moved. Submaps that only moved slightly
+  // since they were linked keep their links.
+  std::vector<SkeletonSubmap::ConstPtr> changed_submaps;
+  std::vector<SkeletonSubmap::ConstPtr> shifted_submaps;
+  for (const SkeletonSubmap::ConstPtr& submap :
+       skeleton_submap_collection_.getSubmapConstPtrs()) {
+    const Transformation T_odom_submap = submap->getPose();
+    auto it = linked_submap_poses_.find(submap->getId());
+    if (it != linked_submap_poses_.end()) {
+      LinkedSubmapPose& linked_pose = it->second;
+      if (maxVertexDisplacement(*submap, linked_pose.T_odom_submap_updated,
+                                T_odom_submap) == 0.f) {
+        continue;
+      }
+      if (maxVertexDisplacement(*submap, linked_pose.T_odom_submap_linked,
+                                T_odom_submap) <=
+          config_.relink_pose_tolerance) {
+        linked_pose.T_odom_submap_updated = T_odom_submap;
+        shifted_submaps.push_back(submap);
         continue;
       }
+    }
+    linked_submap_poses_[submap->getId()] =
+        LinkedSubmapPose{T_odom_submap, T_odom_submap};
+    changed_submaps.push_back(submap);
+  }
+  if (changed_submaps.empty() && shifted_submaps.empty()) {
+    return;
+  }
+  ++link_layer_version_;
 
-      // Check if this neighbor is reachable from the current vertex
-      const voxblox::SkeletonVertex& neighbor_vertex =
-          current_graph->getVertex(neighbor_vertex_id.vertex_id);
-      const voxblox::Point t_odom_neighbor_vertex =
-          current_submap->getPose() * neighbor_vertex.point;
-      if (!comm_->map()->isLineTraversableInGlobalMap(
-              t_odom_current_vertex, t_odom_neighbor_vertex,
-              config_.traversability_radius)) {
-        intraversable_edge_map[current_vertex_id] = neighbor_vertex_id;
+  // Relink the changed submaps, the submaps they overlap with and the
+  // submaps that were linked to them before.
+  std::unordered_set<SubmapId> submaps_to_relink;
+  for (const SkeletonSubmap::ConstPtr& submap : changed_submaps) {
+    submaps_to_relink.insert(submap->getId());
+    auto linking_it = submaps_linking_to_.find(submap->getId());
+    if (linking_it != submaps_linking_to_.end()) {
+      submaps_to_relink.insert(linking_it->second.begin(),
+                               linking_it->second.end());
+    }
+    for (VertexIdElement vertex_id = 0; vertex_id < submap->getNumVertices();
+         ++vertex_id) {
+      for (const SubmapId submap_id : comm_->map()->getSubmapIdsAtPosition(
+               submap->getPose() * submap->getVertexPoint(vertex_id))) {
+        submaps_to_relink.insert(submap_id);
+      }
+    }
+  }
+  for (const SubmapId submap_id : submaps_to_relink) {
+    // Invalidate the cached edge traversabilities of the submap.
+    ++submap_neighborhood_versions_[submap_id];
+    SkeletonSubmap::ConstPtr submap =
+        skeleton_submap_collection_.getSubmapConstPtrById(submap_id);
+    if (submap) {
+      linkSubmap(*submap);
+      updateSubmapPortals(*submap);
+    }
+  }
+
+  // Move the links starting in and leading into the slightly moved submaps
+  // along with them.
+  std::unordered_set<SubmapId> submaps_to_update;
+  for (const SkeletonSubmap::ConstPtr& submap : shifted_submaps) {
+    ++submap_neighborhood_versions_[submap->getId()];
+    submaps_to_update.insert(submap->getId());
+    auto linking_it = submaps_linking_to_.find(submap->getId());
+    if (linking_it != submaps_linking_to_.end()) {
+      submaps_to_update.insert(linking_it->second.begin(),
+                               linking_it->second.end());
+    }
+  }
+  for (const SubmapId submap_id : submaps_to_update) {
+    if (submaps_to_relink.count(submap_id)) {
+      continue;
+    }
+    SkeletonSubmap::ConstPtr submap =
+        skeleton_submap_collection_.getSubmapConstPtrById(submap_id);
+    if (submap) {
+      updateLinkPositions(*submap);
+    }
+  }
+  size_t num_links = 0u;
+  for (const auto& vertex_links_kv : inter_submap_links_) {
+    num_links += vertex_links_kv.second.size();
+  }
+
+  LOG(INFO) << "Updated the skeleton link layer for " << changed_submaps.size()
+            << " changed submaps (" << submaps_to_relink.size()
+            << " relinked) and " << shifted_submaps.size()
+            << " shifted submaps in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::high_resolution_clock::now() - t_start)
+                   .count()
+            << "ms, totaling " << num_links << " links.";
+}
+
+void SkeletonAStar::linkSubmap(const SkeletonSubmap& submap) {
+  // Remove the previous links starting in this submap.
+  const SubmapId submap_id = submap.getId();
+  for (auto& submap_linking_kv : submaps_linking_to_) {
+    submap_linking_kv.second.erase(submap_id);
+  }
+  const Transformation T_odom_submap = submap.getPose();
+  for (VertexIdElement vertex_id = 0; vertex_id < submap.getNumVertices();
+       ++vertex_id) {
+    const GlobalVertexId current_vertex_id{submap_id, vertex_id};
+    inter_submap_links_.erase(current_vertex_id);
+
+    // Unless this vertex already has many neighbors, try to connect to a
+    // neighboring skeleton submap
+    if (3 < submap.getNeighbors(vertex_id).size()) {
+      continue;
+    }
+    const Point t_odom_current_vertex =
+        T_odom_submap * submap.getVertexPoint(vertex_id);
+    std::vector<InterSubmapLink> links;
+    int num_linked_submaps = 0;
+    for (const SubmapId nearby_submap_id :
+         comm_->map()->getSubmapIdsAtPosition(t_odom_current_vertex)) {
+      // Avoid linking the current vertex against vertices of its own submap
+      if (nearby_submap_id == submap_id) {
         continue;
       }
 
-      if (open_set.count(neighbor_vertex_id) == 0) {
-        open_set.insert(neighbor_vertex_id);
+      SkeletonSubmap::ConstPtr nearby_submap =
+          skeleton_submap_collection_.getSubmapConstPtrById(nearby_submap_id);
+      if (!nearby_submap) {
+        continue;
       }
 
-      FloatingPoint tentative_g_score =
-          g_score_map[current_vertex_id] +
-          (neighbor_vertex.point - current_vertex.point).norm();
-      // NOTE: Since the vertex and its neighbor are already in the same
-      //       (submap) frame, we can directly compute their distance above
-      if (g_score_map.count(neighbor_vertex_id) == 0 ||
-          g_score_map[neighbor_vertex_id] < tentative_g_score) {
-        g_score_map[neighbor_vertex_id] = tentative_g_score;
-        f_score_map[neighbor_vertex_id] =
-            tentative_g_score + (goal_point - t_odom_neighbor_vertex).norm();
-        parent_map[neighbor_vertex_id] = current_vertex_id;
+      // Limit the maximum number of submaps that can be linked to
+      if (config_.linking_max_num_submaps < num_linked_submaps ||
+          config_.linking_max_num_links < links.size()) {
+        break;
       }
+
+      const Transformation T_odom_nearby_submap = nearby_submap->getPose();
+      voxblox::Point t_nearby_submap_current_vertex =
+          T_odom_nearby_submap.inverse() * t_odom_current_vertex;
+      std::vector<VertexIdElement> nearest_vertex_ids;
+      nearby_submap->getNClosestVertices(t_nearby_submap_current_vertex,
+                                         config_.linking_num_nearest_neighbors,
+                                         &nearest_vertex_ids);
+
+      bool linked_submap = false;
+      for (const VertexIdElement& nearby_vertex_id : nearest_vertex_ids) {
+        const Point t_odom_nearby_vertex =
+            T_odom_nearby_submap *
+            nearby_submap->getVertexPoint(nearby_vertex_id);
+        const float distance_current_to_nearby_vertex =
+            (t_odom_current_vertex - t_odom_nearby_vertex).norm();
+        if (distance_current_to_nearby_vertex < config_.linking_max_distance &&
+            comm_->map()->isLineTraversableInGlobalMap(
+                t_odom_current_vertex, t_odom_nearby_vertex,
+                config_.traversability_radius)) {
+          links.push_back({GlobalVertexId{nearby_submap_id, nearby_vertex_id},
+                           t_odom_nearby_vertex,
+                           distance_current_to_nearby_vertex});
+          linked_submap = true;
+        }
+      }
+      if (linked_submap) {
+        ++num_linked_submaps;
+        submaps_linking_to_[nearby_submap_id].insert(submap_id);
+      }
+    }
+    if (!links.empty()) {
+      inter_submap_links_[current_vertex_id] = std::move(links);
     }
   }
+}
 
-  return false;
+void SkeletonAStar::updateLinkPositions(const SkeletonSubmap& submap) {
+  const SubmapId submap_id = submap.getId();
+  const Transformation T_odom_submap = submap.getPose();
+  for (VertexIdElement vertex_id = 0; vertex_id < submap.getNumVertices();
+       ++vertex_id) {
+    auto links_it =
+        inter_submap_links_.find(GlobalVertexId{submap_id, vertex_id});
+    if (links_it == inter_submap_links_.end()) {
+      continue;
+    }
+    const Point t_odom_vertex =
+        T_odom_submap * submap.getVertexPoint(vertex_id);
+    for (InterSubmapLink& link : links_it->second) {
+      SkeletonSubmap::ConstPtr target_submap =
+          skeleton_submap_collection_.getSubmapConstPtrById(
+              link.target_vertex_id.submap_id);
+      if (!target_submap) {
+        continue;
+      }
+      link.t_odom_target_vertex =
+          target_submap->getPose() *
+          target_submap->getVertexPoint(link.target_vertex_id.vertex_id);
+      link.length = (link.t_odom_target_vertex - t_odom_vertex).norm();
+    }
+  }
+
+  // The portals hold copies of the links.
+  updateSubmapPortals(submap);
+}
+
+void SkeletonAStar::updateSubmapPortals(const SkeletonSubmap& submap) {
+  // Select the source vertex of the shortest link to each neighboring submap.
+  const SubmapId submap_id = submap.getId();
+  std::unordered_map<SubmapId,
+                     std::pair<VertexIdElement, const InterSubmapLink*>>
+      shortest_links;
+  for (VertexIdElement vertex_id = 0; vertex_id < submap.getNumVertices();
+       ++vertex_id) {
+    auto links_it =
+        inter_submap_links_.find(GlobalVertexId{submap_id, vertex_id});
+    if (links_it == inter_submap_links_.end()) {
+      continue;
+    }
+    for (const InterSubmapLink& link : links_it->second) {
+      auto it = shortest_links.find(link.target_vertex_id.submap_id);
+      if (it == shortest_links.end() ||
+          link.length < it->second.second->length) {
+        shortest_links[link.target_vertex_id.submap_id] = {vertex_id, &link};
+      }
+    }
+  }
+  std::unordered_map<VertexIdElement, Portal>& portals =
+      submap_portals_[submap_id];
+  portals.clear();
+  for (const auto& shortest_link_kv : shortest_links) {
+    Portal& portal = portals[shortest_link_kv.second.first];
+    portal.vertex_id = GlobalVertexId{submap_id, shortest_link_kv.second.first};
+    portal.links.push_back(*shortest_link_kv.second.second);
+  }
+
+  // Compute the distances from each portal along the skeleton with Dijkstra.
+  for (auto& portal_kv : portals) {
+    std::unordered_map<VertexIdElement, FloatingPoint>& distances =
+        portal_kv.second.vertex_distances;
+    IndexedPriorityQueue<VertexIdElement, FloatingPoint> open_set;
+    distances[portal_kv.first] = 0.f;
+    open_set.pushOrDecrease(portal_kv.first, 0.f);
+    while (!open_set.empty()) {
+      const VertexIdElement vertex_id = open_set.pop();
+      const FloatingPoint distance = distances.at(vertex_id);
+      for (const SkeletonSubmap::Neighbor& neighbor :
+           submap.getNeighbors(vertex_id)) {
+        const FloatingPoint tentative_distance =
+            distance + neighbor.edge_length;
+        auto it = distances.find(neighbor.vertex_id);
+        if (it != distances.end() && it->second <= tentative_distance) {
+          continue;
+        }
+        distances[neighbor.vertex_id] = tentative_distance;
+        open_set.pushOrDecrease(neighbor.vertex_id, tentative_distance);
+      }
+    }
+  }
+}
+
+bool SkeletonAStar::isEdgeTraversable(const GlobalVertexId& start_vertex_id,
+                                      const GlobalVertexId& end_vertex_id,
+                                      const Point& t_odom_start_vertex,
+                                      const Point& t_odom_end_vertex,
+                                      SearchStatistics* statistics) const {
+  CHECK_NOTNULL(statistics);
+  if (!config_.cache_edge_traversability) {
+    ++statistics->num_traversability_checks;
+    return comm_->map()->isLineTraversableInGlobalMap(
+        t_odom_start_vertex, t_odom_end_vertex, config_.traversability_radius);
+  }
+
+  // The edges are undirected, so both directions share an entry.
+  const std::pair<GlobalVertexId, GlobalVertexId> edge_key =
+      start_vertex_id < end_vertex_id
+          ? std::make_pair(start_vertex_id, end_vertex_id)
+          : std::make_pair(end_vertex_id, start_vertex_id);
+  auto version_it =
+      submap_neighborhood_versions_.find(start_vertex_id.submap_id);
+  const int neighborhood_version =
+      version_it == submap_neighborhood_versions_.end() ? 0
+                                                        : version_it->second;
+  auto cache_it = edge_traversability_cache_.find(edge_key);
+  if (cache_it != edge_traversability_cache_.end() &&
+      cache_it->second.neighborhood_version == neighborhood_version) {
+    ++statistics->num_cached_traversability_checks;
+    return cache_it->second.is_traversable;
+  }
+
+  // NOTE: The check also considers the local area, which changes without the
+  //       submap poses changing. Its content is however part of the submaps
+  //       that are added later, which invalidate the entries around them.
+  ++statistics->num_traversability_checks;
+  EdgeTraversability& entry = edge_traversability_cache_[edge_key];
+  entry.is_traversable = comm_->map()->isLineTraversableInGlobalMap(
+      t_odom_start_vertex, t_odom_end_vertex, config_.traversability_radius);
+  entry.neighborhood_version = neighborhood_version;
+  return entry.is_traversable;
+}
+
+FloatingPoint SkeletonAStar::maxVertexDisplacement(
+    const SkeletonSubmap& submap, const Transformation& T_O_S_old,
+    const Transformation& T_O_S_new) {
+  if (T_O_S_old.getTransformationMatrix() ==
+      T_O_S_new.getTransformationMatrix()) {
+    return 0.f;
+  }
+  // NOTE: The rotation is applied around the submap origin, so the vertices
+  //       far from it can move much further than the origin itself.
+  const Transformation T_S_old_S_new = T_O_S_old.inverse() * T_O_S_new;
+  FloatingPoint max_displacement = 0.f;
+  for (VertexIdElement vertex_id = 0; vertex_id < submap.getNumVertices();
+       ++vertex_id) {
+    const Point& t_S_vertex = submap.getVertexPoint(vertex_id);
+    max_displacement = std::max(
+        max_displacement, (T_S_old_S_new * t_S_vertex - t_S_vertex).norm());
+  }
+  return max_displacement;
 }
 
 void SkeletonAStar::convertVertexToWaypointPath(
@@ -413,17 +1089,15 @@ void SkeletonAStar::convertVertexToWaypointPath(
       SkeletonSubmap::ConstPtr submap_ptr =
           skeleton_submap_collection_.getSubmapConstPtrById(
               global_vertex_id.submap_id);
-      const voxblox::SkeletonVertex& vertex =
-          submap_ptr->getSkeletonGraph().getVertex(global_vertex_id.vertex_id);
-      const Point t_submap_vertex = vertex.point;
+      const Point t_submap_vertex =
+          submap_ptr->getVertexPoint(global_vertex_id.vertex_id);
       way_points->emplace_back(RelativeWayPoint(submap_ptr, t_submap_vertex));
     }
   }
 }
 
 void SkeletonAStar::getSolutionVertexPath(
-    GlobalVertexId end_vertex_id,
-    const std::map<GlobalVertexId, GlobalVertexId>& parent_map,
+    GlobalVertexId end_vertex_id, const VertexIdMap& parent_map,
     std::vector<GlobalVertexId>* vertex_path) {
   CHECK_NOTNULL(vertex_path);
   vertex_path->clear();
@@ -436,23 +1110,4 @@ void SkeletonAStar::getSolutionVertexPath(
   std::reverse(vertex_path->begin(), vertex_path->end());
 }
 
-GlobalVertexId SkeletonAStar::popSmallestFromOpen(
-    const std::map<GlobalVertexId, FloatingPoint>& f_score_map,
-    std::set<GlobalVertexId>* open_set) {
-  FloatingPoint min_distance = std::numeric_limits<FloatingPoint>::max();
-  auto min_iter = open_set->cbegin();
-
-  for (auto iter = open_set->cbegin(); iter != open_set->cend(); ++iter) {
-    FloatingPoint distance = f_score_map.at(*iter);
-    if (distance < min_distance) {
-      min_distance = distance;
-      min_iter = iter;
-    }
-  }
-
-  GlobalVertexId return_val = *min_iter;
-  open_set->erase(min_iter);
-  return return_val;
-}
-
 }  // namespace glocal_exploration
@@ -0,0 +1,94 @@
+#include "glocal_exploration/planning/global/skeleton/skeleton_submap_collection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace glocal_exploration {
+
+void SkeletonSubmapCollection::addSubmap(
+    cblox::TsdfEsdfSubmap::ConstPtr submap_ptr,
+    const float traversability_radius) {
+  CHECK_NOTNULL(submap_ptr);
+  const SubmapId submap_id = submap_ptr->getID();
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  if (skeleton_submaps_.count(submap_id) ||
+      pending_submaps_.count(submap_id)) {
+    return;
+  }
+  const auto t_scheduled = std::chrono::high_resolution_clock::now();
+  std::future<GenerationResult> generation_result =
+      generation_workers_.enqueue([submap_ptr = std::move(submap_ptr),
+                                   traversability_radius, t_scheduled] {
+        const auto t_start = std::chrono::high_resolution_clock::now();
+        GenerationResult result;
+        result.submap =
+            std::make_shared<SkeletonSubmap>(submap_ptr, traversability_radius);
+        const auto t_end = std::chrono::high_resolution_clock::now();
+        result.generation_time_ms =
+            std::chrono::duration<double, std::milli>(t_end - t_start).count();
+        result.latency_ms =
+            std::chrono::duration<double, std::milli>(t_end - t_scheduled)
+                .count();
+        return result;
+      });
+  pending_submaps_.emplace(submap_id, generation_result.share());
+}
+
+bool SkeletonSubmapCollection::collectFinishedSubmaps() {
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  bool added_submaps = false;
+  for (auto it = pending_submaps_.begin(); it != pending_submaps_.end();) {
+    if (it->second.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    addFinishedSubmap(it->first, it->second.get());
+    it = pending_submaps_.erase(it);
+    added_submaps = true;
+  }
+  return added_submaps;
+}
+
+void SkeletonSubmapCollection::waitForPendingSubmaps() {
+  // Wait without holding the lock, s.t. readers are not blocked meanwhile.
+  // The submaps stay pending until they are collected below.
+  std::map<SubmapId, std::shared_future<GenerationResult>> pending_submaps;
+  {
+    std::lock_guard<std::mutex> lock(submaps_mutex_);
+    pending_submaps = pending_submaps_;
+  }
+  for (auto& pending_submap_kv : pending_submaps) {
+    pending_submap_kv.second.wait();
+  }
+  std::lock_guard<std::mutex> lock(submaps_mutex_);
+  for (auto& pending_submap_kv : pending_submaps) {
+    // Skip the submaps that were collected concurrently.
+    auto it = pending_submaps_.find(pending_submap_kv.first);
+    if (it == pending_submaps_.end()) {
+      continue;
+    }
+    addFinishedSubmap(it->first, it->second.get());
+    pending_submaps_.erase(it);
+  }
+}
+
+void SkeletonSubmapCollection::addFinishedSubmap(SubmapId submap_id,
+                                                 GenerationResult result) {
+  // NOTE: Expects the submaps mutex to be locked by the caller.
+  LOG(INFO) << "Generated skeleton for submap " << submap_id << " in "
+            << result.generation_time_ms << "ms (latency "
+            << result.latency_ms << "ms).";
+  GenerationStatistics& statistics = generation_statistics_;
+  ++statistics.num_generated_submaps;
+  statistics.total_generation_time_ms += result.generation_time_ms;
+  statistics.max_generation_time_ms =
+      std::max(statistics.max_generation_time_ms, result.generation_time_ms);
+  statistics.total_latency_ms += result.latency_ms;
+  statistics.max_latency_ms =
+      std::max(statistics.max_latency_ms, result.latency_ms);
+  skeleton_submaps_.emplace(submap_id, std::move(result.submap));
+}
+
+}  // namespace glocal_exploration
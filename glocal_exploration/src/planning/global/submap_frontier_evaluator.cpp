@@ -1,13 +1,24 @@
 #include "glocal_exploration/planning/global/submap_frontier_evaluator.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stack>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <Eigen/Eigenvalues>
+
 #include "glocal_exploration/state/communicator.h"
 
 namespace glocal_exploration {
@@ -20,6 +31,12 @@ void SubmapFrontierEvaluator::Config::checkParams() const {
   checkParamGT(min_frontier_size, 0, "min_frontier_size");
   checkParamGT(min_num_visible_frontier_points, 0,
                "min_num_visible_frontier_points");
+  checkParamGT(num_threads, 0, "num_threads");
+  checkParamGE(pose_change_tolerance, 0.f, "pose_change_tolerance");
+  checkParamGE(roi_clipping_margin, 0.f, "roi_clipping_margin");
+  checkParamGT(spill_distance, 0.f, "spill_distance");
+  checkParamGT(max_num_representative_points, 0,
+               "max_num_representative_points");
 }
 
 void SubmapFrontierEvaluator::Config::fromRosParam() {
@@ -27,6 +44,14 @@ void SubmapFrontierEvaluator::Config::fromRosParam() {
   rosParam("min_frontier_size", &min_frontier_size);
   rosParam("submaps_are_frozen", &submaps_are_frozen);
   rosParam("min_num_visible_frontier_points", &min_num_visible_frontier_points);
+  rosParam("num_threads", &num_threads);
+  rosParam("pose_change_tolerance", &pose_change_tolerance);
+  rosParam("clip_candidates_to_roi", &clip_candidates_to_roi);
+  rosParam("roi_clipping_margin", &roi_clipping_margin);
+  rosParam("spill_candidates_to_disk", &spill_candidates_to_disk);
+  rosParam("spill_distance", &spill_distance);
+  rosParam("spill_directory", &spill_directory);
+  rosParam("max_num_representative_points", &max_num_representative_points);
 }
 
 void SubmapFrontierEvaluator::Config::printFields() const {
@@ -35,181 +60,805 @@ void SubmapFrontierEvaluator::Config::printFields() const {
   printField("submaps_are_frozen", submaps_are_frozen);
   printField("min_num_visible_frontier_points",
              min_num_visible_frontier_points);
+  printField("num_threads", num_threads);
+  printField("pose_change_tolerance", pose_change_tolerance);
+  printField("clip_candidates_to_roi", clip_candidates_to_roi);
+  printField("roi_clipping_margin", roi_clipping_margin);
+  printField("spill_candidates_to_disk", spill_candidates_to_disk);
+  printField("spill_distance", spill_distance);
+  printField("spill_directory", spill_directory);
+  printField("max_num_representative_points", max_num_representative_points);
 }
 
 SubmapFrontierEvaluator::SubmapFrontierEvaluator(
     const Config& config, std::shared_ptr<Communicator> communicator)
     : GlobalPlannerBase(std::move(communicator)),
-      config_(config.checkValid()) {}
+      config_(config.checkValid()),
+      thread_pool_(config_.num_threads) {}
+
+SubmapFrontierEvaluator::~SubmapFrontierEvaluator() {
+  // Remove the spill files before their directory.
+  {
+    std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+    frontier_candidates_.clear();
+  }
+  if (!unique_spill_directory_.empty()) {
+    rmdir(unique_spill_directory_.c_str());
+  }
+}
 
 void SubmapFrontierEvaluator::computeFrontiersForSubmap(
     const MapBase::SubmapData& data, const Point& initial_point) {
-  // Only one thread allowed at a time to run in background.
-  if (frontier_computation_thread_) {
-    if (frontier_computation_thread_->joinable()) {
-      frontier_computation_thread_->join();
-    }
-  }
-  // Initialize all frontier candidates for the given layer and id.
-  auto it = frontier_candidates_.find(data.id);
-  if (it == frontier_candidates_.end()) {
-    // New id, setup candidates.
-    it = frontier_candidates_
-             .insert(std::make_pair(data.id, std::vector<Point>()))
-             .first;
-  } else if (config_.submaps_are_frozen) {
+  std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+  if (config_.submaps_are_frozen &&
+      (frontier_candidates_.find(data.id) != frontier_candidates_.end() ||
+       pending_frontier_candidates_.find(data.id) !=
+           pending_frontier_candidates_.end())) {
     // Found an existing frozen frontier.
     return;
   }
-  // NOTE: If not frozen the frontiers will be recomputed and overwritten.
+  // NOTE: If not frozen the frontiers will be recomputed and overwritten. A
+  //       computation that is still pending is superseded by the new one.
 
-  // Compute all frontiers.
-  frontier_computation_thread_ =
-      std::make_unique<std::thread>([this, data, initial_point, it] {
-        computeFrontierCandidates(*(data.tsdf_layer), initial_point, &(*it));
+  // Compute all frontiers in the background.
+  // NOTE: The region is computed here, s.t. the ROI is only accessed from
+  //       the planning thread.
+  const SubmapRegion region = computeSubmapRegion(data);
+  pending_frontier_candidates_[data.id] =
+      thread_pool_.enqueue([this, data, initial_point, region] {
+        return FrontierCandidates(
+            computeFrontierCandidates(*(data.tsdf_layer), initial_point,
+                                      data.id, region),
+            data.tsdf_layer->voxel_size());
       });
 }
 
-void SubmapFrontierEvaluator::updateFrontiers(
+std::unordered_set<int> SubmapFrontierEvaluator::collectFrontierCandidates(
     const std::vector<MapBase::SubmapData>& data) {
-  // Make sure frontier computation finished.
-  if (frontier_computation_thread_) {
-    if (frontier_computation_thread_->joinable()) {
-      frontier_computation_thread_->join();
+  // Take over the pending computations of the requested submaps only.
+  std::vector<std::pair<int, std::future<FrontierCandidates>>> requested;
+  {
+    std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+    for (const auto& datum : data) {
+      auto it = pending_frontier_candidates_.find(datum.id);
+      if (it != pending_frontier_candidates_.end()) {
+        requested.emplace_back(datum.id, std::move(it->second));
+        pending_frontier_candidates_.erase(it);
+      }
     }
   }
-  // Verify all frontiers are built. If they are frozen nothing happens.
-  int num_candidate_points = 0;
+  // NOTE: The computations run concurrently, so waiting for them in order
+  //       takes as long as the slowest one.
+  std::unordered_set<int> updated_submap_ids;
+  for (auto& id_future_pair : requested) {
+    FrontierCandidates candidates = id_future_pair.second.get();
+    std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+    frontier_candidates_[id_future_pair.first] = std::move(candidates);
+    updated_submap_ids.insert(id_future_pair.first);
+  }
+  return updated_submap_ids;
+}
+
+void SubmapFrontierEvaluator::updateFrontiers(
+    const std::vector<MapBase::SubmapData>& data) {
+  // Schedule all missing frontier computations and wait for them to finish.
   // NOTE: The submap origin is in free space since it corresponds
   //       to a robot pose by construction.
   Point initial_point(0.f, 0.f, 0.f);
   for (const auto& datum : data) {
     computeFrontiersForSubmap(datum, initial_point);
-    num_candidate_points += frontier_candidates_.find(datum.id)->second.size();
   }
+  const std::unordered_set<int> updated_submap_ids =
+      collectFrontierCandidates(data);
 
-  // Transform and condense all submap frontier candidates to global frame and
-  // check whether they are active. Then extract connected frontiers.
+  // Incrementally update the global frontiers. Only the candidates of submaps
+  // that are new, moved or were recomputed are (re-)inserted, and only the
+  // candidates that could have changed their state are checked again.
   auto t_start = std::chrono::high_resolution_clock::now();
-
-  // Combine all candidates to a global set.
-  // NOTE(schmluk): Reserving the maximum amount of points might waste a bit of
-  //                memory but  prevents costly reallocation of bins and
-  //                rehashing the index. This occurs multiple times downstream.
-  IndexSet global_frontier_points;
-  global_frontier_points.reserve(num_candidate_points);
   FloatingPoint voxel_size = comm_->map()->getVoxelSize();
   CHECK_GT(voxel_size, 0.f);
   FloatingPoint voxel_size_inv = 1.f / voxel_size;
+  const FloatingPoint cell_size_inv = 1.f / (kCellSizeInVoxels * voxel_size);
+
+  // Verify the right number of transformations were supplied.
+  std::unordered_set<int> supplied_submap_ids;
   for (const auto& datum : data) {
-    auto it = frontier_candidates_.find(datum.id);
-    for (const Point& candidate_S : it->second) {
-      Point candidate_M = datum.T_M_S * candidate_S;
+    supplied_submap_ids.insert(datum.id);
+  }
+  {
+    std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+    for (const auto& id_submap_pair : frontier_candidates_) {
+      if (supplied_submap_ids.find(id_submap_pair.first) ==
+          supplied_submap_ids.end()) {
+        LOG(WARNING)
+            << "No update data for submap id " << id_submap_pair.first
+            << " was supplied, its frontier candidates will be ignored.";
+      }
+    }
+  }
+
+  // Remove the submaps that changed or are no longer supplied. Submaps that
+  // only moved by a fraction of a voxel keep their candidates, s.t. the small
+  // corrections of every pose graph optimization do not trigger a rebuild.
+  // NOTE: Points whose active state might change are collected in
+  //       'changed_points', the map regions affected in 'touched_cells'.
+  std::vector<Index> changed_points;
+  voxblox::IndexSet touched_cells;
+  std::vector<const MapBase::SubmapData*> submaps_to_add;
+  std::unordered_set<int> submap_ids_to_add;
+  const FloatingPoint pose_change_tolerance =
+      config_.pose_change_tolerance * voxel_size;
+  for (const auto& datum : data) {
+    auto it = tracked_submaps_.find(datum.id);
+    if (it != tracked_submaps_.end() &&
+        updated_submap_ids.find(datum.id) == updated_submap_ids.end() &&
+        maxExtentDisplacement(it->second, datum.T_M_S) <=
+            pose_change_tolerance) {
+      continue;
+    }
+    submaps_to_add.push_back(&datum);
+    submap_ids_to_add.insert(datum.id);
+  }
+  for (auto it = tracked_submaps_.begin(); it != tracked_submaps_.end();) {
+    if (supplied_submap_ids.find(it->first) != supplied_submap_ids.end() &&
+        submap_ids_to_add.find(it->first) == submap_ids_to_add.end()) {
+      ++it;
+      continue;
+    }
+    for (const Index& index : it->second.global_points) {
+      auto candidate_it = global_candidates_.find(index);
+      if (--candidate_it->second.num_submaps == 0) {
+        global_candidates_.erase(candidate_it);
+        changed_points.push_back(index);
+      }
+    }
+    touched_cells.insert(it->second.footprint_cells.begin(),
+                         it->second.footprint_cells.end());
+    it = tracked_submaps_.erase(it);
+  }
+
+  // Add the new and changed submaps at their current pose.
+  // NOTE: The map of candidates is only modified on this thread, but searched
+  //       by computeFrontiersForSubmap() from the new submap callbacks. So the
+  //       references to its elements stay valid without holding the lock.
+  for (const MapBase::SubmapData* datum : submaps_to_add) {
+    FrontierCandidates* candidates;
+    {
+      std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+      candidates = &frontier_candidates_.at(datum->id);
+    }
+    if (!candidates->loadFromFile()) {
+      // The spilled candidates are lost, recompute them for the next update.
+      {
+        std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+        frontier_candidates_.erase(datum->id);
+      }
+      computeFrontiersForSubmap(*datum, initial_point);
+      continue;
+    }
+    TrackedSubmap& tracked_submap = tracked_submaps_[datum->id];
+    tracked_submap.T_M_S = datum->T_M_S;
+    voxblox::BlockIndexList block_indices;
+    datum->tsdf_layer->getAllAllocatedBlocks(&block_indices);
+    const FloatingPoint block_size = datum->tsdf_layer->block_size();
+    tracked_submap.extent_min_S =
+        Point::Constant(std::numeric_limits<FloatingPoint>::max());
+    tracked_submap.extent_max_S =
+        Point::Constant(std::numeric_limits<FloatingPoint>::lowest());
+    for (const voxblox::BlockIndex& block_index : block_indices) {
+      const Point t_S_block_origin =
+          voxblox::getOriginPointFromGridIndex(block_index, block_size);
+      tracked_submap.extent_min_S =
+          tracked_submap.extent_min_S.cwiseMin(t_S_block_origin);
+      tracked_submap.extent_max_S = tracked_submap.extent_max_S.cwiseMax(
+          t_S_block_origin + Point::Constant(block_size));
+    }
+    if (block_indices.empty()) {
+      tracked_submap.extent_min_S.setZero();
+      tracked_submap.extent_max_S.setZero();
+    }
+    tracked_submap.footprint_cells =
+        computeFootprintCells(*datum, cell_size_inv);
+    touched_cells.insert(tracked_submap.footprint_cells.begin(),
+                         tracked_submap.footprint_cells.end());
+    IndexSet submap_points;
+    for (const Point& candidate_S : candidates->getPoints()) {
+      Point candidate_M = datum->T_M_S * candidate_S;
       if (comm_->regionOfInterest()->contains(candidate_M)) {
-        global_frontier_points.insert(
-            indexFromPoint(candidate_M, voxel_size_inv));
+        submap_points.insert(indexFromPoint(candidate_M, voxel_size_inv));
       }
     }
+    tracked_submap.global_points.assign(submap_points.begin(),
+                                        submap_points.end());
+    for (const Index& index : tracked_submap.global_points) {
+      ++global_candidates_[index].num_submaps;
+    }
   }
 
-  // Verify the right number of transformations were supplied.
-  for (const auto& id_submap_pair : frontier_candidates_) {
-    if (std::find_if(data.begin(), data.end(),
-                     [id_submap_pair](const MapBase::SubmapData& d) {
-                       return d.id == id_submap_pair.first;
-                     }) == data.end()) {
-      LOG(WARNING) << "No update data for submap id " << id_submap_pair.first
-                   << " was supplied, its frontier candidates will be ignored.";
+  // Check the candidates that are active or lie in a touched region again.
+  // Observed candidates elsewhere can not have become unobserved.
+  std::vector<std::pair<const Index, GlobalCandidate>*> candidates_to_check;
+  std::vector<Point> points_to_check;
+  for (auto& index_candidate_pair : global_candidates_) {
+    const Point point =
+        centerPointFromIndex(index_candidate_pair.first, voxel_size);
+    if (index_candidate_pair.second.is_observed &&
+        touched_cells.find(voxblox::getGridIndexFromPoint<voxblox::BlockIndex>(
+            point, cell_size_inv)) == touched_cells.end()) {
+      continue;
+    }
+    candidates_to_check.push_back(&index_candidate_pair);
+    points_to_check.push_back(point);
+  }
+  const int num_checked_points = points_to_check.size();
+  std::vector<bool> is_observed;
+  comm_->map()->areObservedInGlobalMap(points_to_check, &is_observed);
+  for (size_t i = 0u; i < candidates_to_check.size(); ++i) {
+    const Index& index = candidates_to_check[i]->first;
+    GlobalCandidate& candidate = candidates_to_check[i]->second;
+    candidate.is_observed = is_observed[i];
+    const bool is_clustered =
+        active_point_to_cluster_.find(index) != active_point_to_cluster_.end();
+    if (candidate.is_observed == is_clustered) {
+      changed_points.push_back(index);
     }
   }
 
-  // Remove all inactive candidates.
-  const int num_global_candidates = global_frontier_points.size();
-  inactive_frontiers_.clear();
-  inactive_frontiers_.reserve(num_global_candidates);
-  auto it = global_frontier_points.begin();
-  while (it != global_frontier_points.end()) {
-    Point candidate = centerPointFromIndex(*it, voxel_size);
-    if (comm_->map()->isObservedInGlobalMap(candidate)) {
-      it = global_frontier_points.erase(it);
-      inactive_frontiers_.push_back(candidate);
-    } else {
-      it++;
+  // Recluster only the clusters affected by the changed points.
+  std::unordered_set<int> affected_cluster_ids;
+  IndexSet points_to_cluster;
+  for (const Index& index : changed_points) {
+    auto cluster_it = active_point_to_cluster_.find(index);
+    if (cluster_it != active_point_to_cluster_.end()) {
+      affected_cluster_ids.insert(cluster_it->second);
+    }
+    auto candidate_it = global_candidates_.find(index);
+    if (candidate_it == global_candidates_.end() ||
+        candidate_it->second.is_observed) {
+      continue;
+    }
+    points_to_cluster.insert(index);
+    for (const Index& offset : kNeighborOffsets) {
+      auto neighbor_it = active_point_to_cluster_.find(index + offset);
+      if (neighbor_it != active_point_to_cluster_.end()) {
+        affected_cluster_ids.insert(neighbor_it->second);
+      }
     }
   }
+  for (const int cluster_id : affected_cluster_ids) {
+    for (const Index& index : clusters_.at(cluster_id)) {
+      active_point_to_cluster_.erase(index);
+      auto candidate_it = global_candidates_.find(index);
+      if (candidate_it != global_candidates_.end() &&
+          !candidate_it->second.is_observed) {
+        points_to_cluster.insert(index);
+      }
+    }
+    clusters_.erase(cluster_id);
+    cluster_summaries_.erase(cluster_id);
+  }
+  for (std::vector<Index>& cluster : clusterFrontierPoints(points_to_cluster)) {
+    const int cluster_id = next_cluster_id_++;
+    for (const Index& index : cluster) {
+      active_point_to_cluster_[index] = cluster_id;
+    }
+    clusters_[cluster_id] = std::move(cluster);
+  }
 
-  // Cluster frontiers.
-  const int num_active_points = global_frontier_points.size();
+  // Write the results.
   int num_final_points = 0;
   int num_frontiers = 0;
   active_frontiers_.clear();
-  while (!global_frontier_points.empty()) {
-    // Setup search with first point left in candidates.
-    IndexSet open_set;
-    IndexSet result_set;
-    open_set.reserve(num_active_points);
-    result_set.reserve(num_active_points);
-    open_set.insert(*global_frontier_points.begin());
-    result_set.insert(*global_frontier_points.begin());
-    global_frontier_points.erase(global_frontier_points.begin());
-
-    // Find all points connected to this frontier.
-    while (!open_set.empty()) {
-      const Index& open_point = *open_set.begin();
-      for (const Index& offset : kNeighborOffsets) {
-        const Index candidate = open_point + offset;
-        // Check whether it is a valid frontier point.
-        if (global_frontier_points.find(candidate) !=
-            global_frontier_points.end()) {
-          open_set.insert(candidate);
-          result_set.insert(candidate);
-          global_frontier_points.erase(candidate);
-        }
-      }
-      open_set.erase(open_set.begin());
+  active_frontier_summaries_.clear();
+  inactive_frontiers_.clear();
+  for (const auto& index_candidate_pair : global_candidates_) {
+    if (index_candidate_pair.second.is_observed) {
+      inactive_frontiers_.push_back(
+          centerPointFromIndex(index_candidate_pair.first, voxel_size));
     }
-
-    // Check whether the final result matches the criteria and write result.
-    if (result_set.size() >= config_.min_frontier_size) {
+  }
+  for (const auto& id_cluster_pair : clusters_) {
+    const std::vector<Index>& cluster = id_cluster_pair.second;
+    // Check whether the cluster matches the criteria and write result.
+    if (cluster.size() >= config_.min_frontier_size) {
       std::vector<Point>& new_frontier = active_frontiers_.emplace_back();
-      new_frontier.reserve(result_set.size());
-      for (const Index& idx : result_set) {
+      new_frontier.reserve(cluster.size());
+      for (const Index& idx : cluster) {
         new_frontier.emplace_back(centerPointFromIndex(idx, voxel_size));
       }
-      num_final_points += result_set.size();
+      // The summaries are cached, since most clusters persist across updates.
+      auto summary_it = cluster_summaries_.find(id_cluster_pair.first);
+      if (summary_it == cluster_summaries_.end()) {
+        FrontierSummary summary = summarizeFrontier(new_frontier);
+        summary.cluster_id = id_cluster_pair.first;
+        summary_it = cluster_summaries_
+                         .emplace(id_cluster_pair.first, std::move(summary))
+                         .first;
+      }
+      active_frontier_summaries_.push_back(summary_it->second);
+      num_final_points += cluster.size();
       num_frontiers++;
     } else {
-      for (const Index& idx : result_set) {
+      for (const Index& idx : cluster) {
         inactive_frontiers_.emplace_back(centerPointFromIndex(idx, voxel_size));
       }
     }
   }
 
+  if (config_.spill_candidates_to_disk) {
+    spillFrontierCandidates();
+  }
+
   // Logging.
   auto t_end = std::chrono::high_resolution_clock::now();
   std::stringstream info;
-  info << "Updated global frontiers based on " << data.size() << " submaps in "
+  info << "Updated global frontiers based on " << data.size() << " submaps ("
+       << submaps_to_add.size() << " changed) in "
        << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start)
               .count()
        << "ms.";
   if (config_.verbosity >= 3) {
-    info << " " << num_candidate_points << " candidates -> "
-         << num_global_candidates << " global candidates -> "
-         << num_active_points << " active points -> " << num_frontiers
-         << " frontiers, totaling " << num_final_points << " points.";
+    info << " " << global_candidates_.size() << " global candidates, "
+         << num_checked_points << " checked -> "
+         << active_point_to_cluster_.size() << " active points -> "
+         << affected_cluster_ids.size() << " clusters reclustered -> "
+         << num_frontiers << " frontiers, totaling " << num_final_points
+         << " points.";
   }
   LOG_IF(INFO, config_.verbosity >= 2) << info.str();
 }
 
-void SubmapFrontierEvaluator::computeFrontierCandidates(
+SubmapFrontierEvaluator::FrontierSummary
+SubmapFrontierEvaluator::summarizeFrontier(
+    const std::vector<Point>& points) const {
+  FrontierSummary summary;
+  if (points.empty()) {
+    return summary;
+  }
+  summary.num_points = points.size();
+  summary.aabb_min = points.front();
+  summary.aabb_max = points.front();
+  for (const Point& point : points) {
+    summary.centroid += point;
+    summary.aabb_min = summary.aabb_min.cwiseMin(point);
+    summary.aabb_max = summary.aabb_max.cwiseMax(point);
+  }
+  summary.centroid /= summary.num_points;
+
+  // The principal direction is the eigenvector of the largest eigenvalue of
+  // the points' covariance.
+  Eigen::Matrix3f covariance = Eigen::Matrix3f::Zero();
+  for (const Point& point : points) {
+    const Point offset = point - summary.centroid;
+    covariance += offset * offset.transpose();
+  }
+  const Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigen_solver(
+      covariance);
+  if (eigen_solver.info() == Eigen::Success) {
+    // NOTE: The eigenvalues are sorted in increasing order.
+    summary.principal_direction = eigen_solver.eigenvectors().col(2);
+  }
+
+  // Subsample the points with a constant stride.
+  const size_t stride =
+      (points.size() + config_.max_num_representative_points - 1) /
+      config_.max_num_representative_points;
+  summary.representative_points.reserve(points.size() / stride + 1);
+  for (size_t i = 0u; i < points.size(); i += stride) {
+    summary.representative_points.push_back(points[i]);
+  }
+  return summary;
+}
+
+void SubmapFrontierEvaluator::spillFrontierCandidates() {
+  // NOTE: Spilled candidates are only loaded again once their submap changes,
+  //       at which point they are spilled again if still far away.
+  // NOTE: The candidates are collected under the lock, but spilled without
+  //       it, s.t. the new submap callbacks are not blocked by the file IO.
+  const Point robot_position = comm_->currentPose().position;
+  std::vector<std::pair<int, FrontierCandidates*>> id_candidates_pairs;
+  {
+    std::lock_guard<std::mutex> lock(pending_frontier_candidates_mutex_);
+    for (auto& id_candidates_pair : frontier_candidates_) {
+      id_candidates_pairs.emplace_back(id_candidates_pair.first,
+                                       &id_candidates_pair.second);
+    }
+  }
+  for (const auto& id_candidates_pair : id_candidates_pairs) {
+    FrontierCandidates& candidates = *id_candidates_pair.second;
+    auto tracked_submap_it = tracked_submaps_.find(id_candidates_pair.first);
+    if (candidates.isSpilled() || candidates.size() == 0u ||
+        tracked_submap_it == tracked_submaps_.end() ||
+        (tracked_submap_it->second.T_M_S.getPosition() - robot_position)
+                .norm() < config_.spill_distance) {
+      continue;
+    }
+    if (unique_spill_directory_.empty()) {
+      // Planners sharing the spill directory must not overwrite each other's
+      // files, so each evaluator uses a directory with a unique name.
+      std::string directory_template =
+          config_.spill_directory + "/glocal_frontier_candidates_XXXXXX";
+      if (!mkdtemp(&directory_template[0])) {
+        LOG(WARNING) << "Could not create a spill directory in '"
+                     << config_.spill_directory
+                     << "', keeping the frontier candidates in memory.";
+        return;
+      }
+      unique_spill_directory_ = directory_template;
+    }
+    candidates.spillToFile(unique_spill_directory_ +
+                           "/frontier_candidates_submap_" +
+                           std::to_string(id_candidates_pair.first) + ".bin");
+  }
+}
+
+FloatingPoint SubmapFrontierEvaluator::maxExtentDisplacement(
+    const TrackedSubmap& submap, const Transformation& T_M_S_new) {
+  if (submap.T_M_S.getTransformationMatrix() ==
+      T_M_S_new.getTransformationMatrix()) {
+    return 0.f;
+  }
+  // NOTE: The displacement is convex in the position, so it is largest at
+  //       one of the corners of the extent.
+  const Transformation T_S_old_S_new = submap.T_M_S.inverse() * T_M_S_new;
+  FloatingPoint max_displacement = 0.f;
+  for (int corner_idx = 0; corner_idx < 8; ++corner_idx) {
+    const Point t_S_corner(
+        corner_idx & 1 ? submap.extent_max_S.x() : submap.extent_min_S.x(),
+        corner_idx & 2 ? submap.extent_max_S.y() : submap.extent_min_S.y(),
+        corner_idx & 4 ? submap.extent_max_S.z() : submap.extent_min_S.z());
+    max_displacement = std::max(
+        max_displacement, (T_S_old_S_new * t_S_corner - t_S_corner).norm());
+  }
+  return max_displacement;
+}
+
+voxblox::IndexSet SubmapFrontierEvaluator::computeFootprintCells(
+    const MapBase::SubmapData& data, FloatingPoint cell_size_inv) const {
+  // Get the cells overlapped by the AABBs of all the submap's blocks.
+  voxblox::IndexSet cells;
+  const voxblox::Layer<voxblox::TsdfVoxel>& layer = *data.tsdf_layer;
+  voxblox::BlockIndexList block_indices;
+  layer.getAllAllocatedBlocks(&block_indices);
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    const Point t_S_block_origin =
+        voxblox::getOriginPointFromGridIndex(block_index, layer.block_size());
+    voxblox::BlockIndex aabb_min =
+        voxblox::BlockIndex::Constant(std::numeric_limits<int>::max());
+    voxblox::BlockIndex aabb_max =
+        voxblox::BlockIndex::Constant(std::numeric_limits<int>::lowest());
+    for (int corner_idx = 0; corner_idx < 8; ++corner_idx) {
+      const Point corner_offset(corner_idx & 1, (corner_idx >> 1) & 1,
+                                (corner_idx >> 2) & 1);
+      const voxblox::BlockIndex corner_cell =
+          voxblox::getGridIndexFromPoint<voxblox::BlockIndex>(
+              data.T_M_S * (t_S_block_origin +
+                            layer.block_size() * corner_offset),
+              cell_size_inv);
+      aabb_min = aabb_min.cwiseMin(corner_cell);
+      aabb_max = aabb_max.cwiseMax(corner_cell);
+    }
+    for (int x = aabb_min.x(); x <= aabb_max.x(); ++x) {
+      for (int y = aabb_min.y(); y <= aabb_max.y(); ++y) {
+        for (int z = aabb_min.z(); z <= aabb_max.z(); ++z) {
+          cells.insert(voxblox::BlockIndex(x, y, z));
+        }
+      }
+    }
+  }
+  return cells;
+}
+
+std::vector<std::vector<SubmapFrontierEvaluator::Index>>
+SubmapFrontierEvaluator::clusterFrontierPoints(const IndexSet& points) const {
+  // Label the 26-connected components in a single pass using union-find.
+  std::vector<Index> point_list(points.begin(), points.end());
+  voxblox::LongIndexHashMapType<int>::type point_ids;
+  point_ids.reserve(point_list.size());
+  for (int id = 0; id < point_list.size(); ++id) {
+    point_ids.emplace(point_list[id], id);
+  }
+
+  std::vector<int> parents(point_list.size());
+  std::vector<int> sizes(point_list.size(), 1);
+  for (int id = 0; id < parents.size(); ++id) {
+    parents[id] = id;
+  }
+  auto find_root = [&parents](int id) {
+    while (parents[id] != id) {
+      // Path halving.
+      parents[id] = parents[parents[id]];
+      id = parents[id];
+    }
+    return id;
+  };
+
+  for (int id = 0; id < point_list.size(); ++id) {
+    for (const Index& offset : kNeighborOffsets) {
+      auto it = point_ids.find(point_list[id] + offset);
+      if (it == point_ids.end()) {
+        continue;
+      }
+      int root = find_root(id);
+      int neighbor_root = find_root(it->second);
+      if (root == neighbor_root) {
+        continue;
+      }
+      // Union by size.
+      if (sizes[root] < sizes[neighbor_root]) {
+        std::swap(root, neighbor_root);
+      }
+      parents[neighbor_root] = root;
+      sizes[root] += sizes[neighbor_root];
+    }
+  }
+
+  // Collect the points of each component.
+  std::vector<std::vector<Index>> clusters;
+  std::unordered_map<int, int> root_to_cluster;
+  for (int id = 0; id < point_list.size(); ++id) {
+    const int root = find_root(id);
+    auto it = root_to_cluster.find(root);
+    if (it == root_to_cluster.end()) {
+      it = root_to_cluster.emplace(root, clusters.size()).first;
+      clusters.emplace_back().reserve(sizes[root]);
+    }
+    clusters[it->second].push_back(point_list[id]);
+  }
+  return clusters;
+}
+
+SubmapFrontierEvaluator::SubmapRegion
+SubmapFrontierEvaluator::computeSubmapRegion(
+    const MapBase::SubmapData& data) const {
+  SubmapRegion region;
+  if (!config_.clip_candidates_to_roi ||
+      !comm_->regionOfInterest()->getBoundingBox(&region.min_corner_M,
+                                                 &region.max_corner_M)) {
+    return region;
+  }
+  region.is_bounded = true;
+  region.T_M_S = data.T_M_S;
+  region.min_corner_M -= Point::Constant(config_.roi_clipping_margin);
+  region.max_corner_M += Point::Constant(config_.roi_clipping_margin);
+  return region;
+}
+
+bool SubmapFrontierEvaluator::SubmapRegion::contains(
+    const Point& point_S) const {
+  if (!is_bounded) {
+    return true;
+  }
+  const Point point_M = T_M_S * point_S;
+  return (point_M.array() >= min_corner_M.array()).all() &&
+         (point_M.array() <= max_corner_M.array()).all();
+}
+
+SubmapFrontierEvaluator::RegionOverlap
+SubmapFrontierEvaluator::SubmapRegion::classifyBlock(
+    const voxblox::BlockIndex& block_index, FloatingPoint block_size) const {
+  if (!is_bounded) {
+    return RegionOverlap::kInside;
+  }
+  // The block is an oriented box in mission frame. It is inside the region if
+  // all its corners are, and outside if its bounding box does not overlap.
+  const Point block_origin_S = block_index.cast<FloatingPoint>() * block_size;
+  Point block_min_M =
+      Point::Constant(std::numeric_limits<FloatingPoint>::max());
+  Point block_max_M =
+      Point::Constant(std::numeric_limits<FloatingPoint>::lowest());
+  for (int corner = 0; corner < 8; ++corner) {
+    const Point offset((corner & 1) ? block_size : 0.f,
+                       (corner & 2) ? block_size : 0.f,
+                       (corner & 4) ? block_size : 0.f);
+    const Point corner_M = T_M_S * (block_origin_S + offset);
+    block_min_M = block_min_M.cwiseMin(corner_M);
+    block_max_M = block_max_M.cwiseMax(corner_M);
+  }
+  if ((block_max_M.array() < min_corner_M.array()).any() ||
+      (block_min_M.array() > max_corner_M.array()).any()) {
+    return RegionOverlap::kOutside;
+  }
+  if ((block_min_M.array() >= min_corner_M.array()).all() &&
+      (block_max_M.array() <= max_corner_M.array()).all()) {
+    return RegionOverlap::kInside;
+  }
+  return RegionOverlap::kPartial;
+}
+
+SubmapFrontierEvaluator::BlockOverlapMap
+SubmapFrontierEvaluator::classifyBlocks(
+    const voxblox::Layer<voxblox::TsdfVoxel>& layer,
+    const SubmapRegion& region) const {
+  // Frontiers can also lie in unallocated blocks bordering free space.
+  voxblox::BlockIndexList allocated_blocks;
+  layer.getAllAllocatedBlocks(&allocated_blocks);
+  voxblox::IndexSet blocks_to_check(allocated_blocks.begin(),
+                                    allocated_blocks.end());
+  for (const voxblox::BlockIndex& block_index : allocated_blocks) {
+    for (const auto& offset : kNeighborOffsets) {
+      blocks_to_check.insert(block_index +
+                             offset.cast<voxblox::IndexElement>());
+    }
+  }
+  BlockOverlapMap result;
+  for (const voxblox::BlockIndex& block_index : blocks_to_check) {
+    const RegionOverlap overlap =
+        region.classifyBlock(block_index, layer.block_size());
+    if (overlap != RegionOverlap::kOutside) {
+      result[block_index] = overlap;
+    }
+  }
+  return result;
+}
+
+std::vector<Point> SubmapFrontierEvaluator::computeFrontierCandidates(
     const voxblox::Layer<voxblox::TsdfVoxel>& layer, const Point& initial_point,
-    std::pair<const int, std::vector<Point>>* output) {
-  // Perform a full sweep over the submap's free space to identify frontier
-  // candidates. Frontiers are unknown points that border observed free space
-  // and are attributed to the submap that contains the free space. Use
-  // depth-first search for better cache coherence.
-  CHECK_NOTNULL(output);
+    int submap_id, const SubmapRegion& region) const {
+  // Frontiers are unknown points that border observed free space and are
+  // attributed to the submap that contains the free space.
   auto t_start = std::chrono::high_resolution_clock::now();
+  std::vector<Point> result;
+  if (layer.voxels_per_side() <= kMaxVoxelsPerSideForSweep) {
+    result = sweepFrontierCandidates(layer, region);
+  } else {
+    result = searchFrontierCandidates(layer, initial_point, region);
+  }
+  auto t_end = std::chrono::high_resolution_clock::now();
+
+  // Logging
+  LOG_IF(INFO, config_.verbosity >= 2)
+      << "Found " << result.size() << " frontier candidates in submap "
+      << submap_id << (region.is_bounded ? " (clipped to the ROI)" : "")
+      << " in "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start)
+             .count()
+      << "ms.";
+  return result;
+}
+
+std::vector<Point> SubmapFrontierEvaluator::sweepFrontierCandidates(
+    const voxblox::Layer<voxblox::TsdfVoxel>& layer,
+    const SubmapRegion& region) const {
+  // Sweep over all allocated blocks and classify their voxels into dense
+  // bitmasks, where each row along x is stored as one word. The frontiers are
+  // then found by dilating the free space masks by one voxel (26-connected)
+  // with bitwise shifts, and intersecting them with the unknown space.
+  // NOTE: Contrary to the search, this considers all free space in the submap
+  //       and not only the part connected to the initial point.
+  const int voxels_per_side = layer.voxels_per_side();
+  const FloatingPoint voxel_size = layer.voxel_size();
+  const int num_rows = voxels_per_side * voxels_per_side;
+  const uint64_t row_mask = voxels_per_side == kMaxVoxelsPerSideForSweep
+                                ? ~uint64_t{0}
+                                : (uint64_t{1} << voxels_per_side) - 1u;
+
+  // Only blocks that overlap the region can contain frontiers.
+  const BlockOverlapMap blocks_to_check = classifyBlocks(layer, region);
+
+  // Classify the voxels of all blocks in or next to the blocks to check.
+  voxblox::BlockIndexList allocated_blocks;
+  layer.getAllAllocatedBlocks(&allocated_blocks);
+  voxblox::AnyIndexHashMapType<BlockMasks>::type block_masks;
+  block_masks.reserve(allocated_blocks.size());
+  for (const voxblox::BlockIndex& block_index : allocated_blocks) {
+    bool is_needed = blocks_to_check.count(block_index) != 0u;
+    for (const auto& offset : kNeighborOffsets) {
+      if (is_needed) {
+        break;
+      }
+      const voxblox::BlockIndex neighbor_index =
+          block_index + offset.cast<voxblox::IndexElement>();
+      is_needed = blocks_to_check.count(neighbor_index) != 0u;
+    }
+    if (!is_needed) {
+      continue;
+    }
+    const voxblox::Block<voxblox::TsdfVoxel>& block =
+        layer.getBlockByIndex(block_index);
+    BlockMasks& masks = block_masks[block_index];
+    masks.free_rows.resize(num_rows, 0u);
+    masks.observed_rows.resize(num_rows, 0u);
+    for (size_t linear_index = 0u; linear_index < block.num_voxels();
+         ++linear_index) {
+      const MapBase::VoxelState state =
+          classifyVoxel(block.getVoxelByLinearIndex(linear_index), voxel_size);
+      if (state == MapBase::VoxelState::kUnknown) {
+        continue;
+      }
+      const int row = linear_index / voxels_per_side;
+      const uint64_t bit = uint64_t{1} << (linear_index % voxels_per_side);
+      masks.observed_rows[row] |= bit;
+      if (state == MapBase::VoxelState::kFree) {
+        masks.free_rows[row] |= bit;
+      }
+    }
+  }
+
+  // Find the frontiers block by block.
+  std::vector<Point> result;
+  for (const auto& index_overlap_pair : blocks_to_check) {
+    const voxblox::BlockIndex& block_index = index_overlap_pair.first;
+    const bool check_region =
+        index_overlap_pair.second == RegionOverlap::kPartial;
+    // Cache the masks of the block and its neighbors, nullptr if unallocated.
+    const BlockMasks* neighborhood[3][3][3];
+    for (int dx = 0; dx < 3; ++dx) {
+      for (int dy = 0; dy < 3; ++dy) {
+        for (int dz = 0; dz < 3; ++dz) {
+          auto it = block_masks.find(
+              block_index + voxblox::BlockIndex(dx - 1, dy - 1, dz - 1));
+          neighborhood[dx][dy][dz] =
+              it == block_masks.end() ? nullptr : &it->second;
+        }
+      }
+    }
+    const BlockMasks* center = neighborhood[1][1][1];
+    const Index block_voxel_offset =
+        block_index.cast<voxblox::LongIndexElement>() *
+        static_cast<voxblox::LongIndexElement>(voxels_per_side);
+
+    for (int z = 0; z < voxels_per_side; ++z) {
+      for (int y = 0; y < voxels_per_side; ++y) {
+        // Dilate the free space of the 3x3 rows surrounding this row.
+        uint64_t dilated_free = 0u;
+        for (int dz = -1; dz <= 1; ++dz) {
+          for (int dy = -1; dy <= 1; ++dy) {
+            int neighbor_y = y + dy;
+            int neighbor_z = z + dz;
+            const int block_dy =
+                neighbor_y < 0 ? 0 : (neighbor_y < voxels_per_side ? 1 : 2);
+            const int block_dz =
+                neighbor_z < 0 ? 0 : (neighbor_z < voxels_per_side ? 1 : 2);
+            neighbor_y -= (block_dy - 1) * voxels_per_side;
+            neighbor_z -= (block_dz - 1) * voxels_per_side;
+            const int row = neighbor_y + neighbor_z * voxels_per_side;
+            const BlockMasks* lower = neighborhood[0][block_dy][block_dz];
+            const BlockMasks* middle = neighborhood[1][block_dy][block_dz];
+            const BlockMasks* upper = neighborhood[2][block_dy][block_dz];
+            if (middle) {
+              const uint64_t free = middle->free_rows[row];
+              dilated_free |= free | (free << 1) | (free >> 1);
+            }
+            if (lower) {
+              dilated_free |= lower->free_rows[row] >> (voxels_per_side - 1);
+            }
+            if (upper) {
+              dilated_free |= (upper->free_rows[row] & 1u)
+                              << (voxels_per_side - 1);
+            }
+          }
+        }
+
+        // Frontiers are unknown voxels bordering free space.
+        const int row = y + z * voxels_per_side;
+        uint64_t frontiers = dilated_free & row_mask;
+        if (center) {
+          frontiers &= ~center->observed_rows[row];
+        }
+        while (frontiers) {
+          const int x = __builtin_ctzll(frontiers);
+          frontiers &= frontiers - 1u;
+          const Point candidate = centerPointFromIndex(
+              block_voxel_offset + Index(x, y, z), voxel_size);
+          if (!check_region || region.contains(candidate)) {
+            result.push_back(candidate);
+          }
+        }
+      }
+    }
+  }
+  return result;
+}
+
+std::vector<Point> SubmapFrontierEvaluator::searchFrontierCandidates(
+    const voxblox::Layer<voxblox::TsdfVoxel>& layer, const Point& initial_point,
+    const SubmapRegion& region) const {
+  // Perform a full sweep over the submap's free space to identify frontier
+  // candidates. Use depth-first search for better cache coherence.
+  // NOTE: The search is bounded to the blocks that overlap the region.
+  const BlockOverlapMap blocks_to_check = classifyBlocks(layer, region);
+  const int voxels_per_side = layer.voxels_per_side();
 
   // Cache submap data.
   FloatingPoint voxel_size = layer.voxel_size();
@@ -236,6 +885,13 @@ void SubmapFrontierEvaluator::computeFrontierCandidates(
         continue;
       }
       closed_list.insert(candidate);
+      const auto overlap_it =
+          blocks_to_check.find(voxblox::getBlockIndexFromGlobalVoxelIndex(
+              candidate, 1.f / voxels_per_side));
+      if (overlap_it == blocks_to_check.end()) {
+        // Outside the region.
+        continue;
+      }
       switch (voxelState(candidate, layer)) {
         case MapBase::VoxelState::kFree: {
           // Adjacent free space to continue the search.
@@ -244,7 +900,11 @@ void SubmapFrontierEvaluator::computeFrontierCandidates(
         }
         case MapBase::VoxelState::kUnknown: {
           // This is a frontier point.
-          result.push_back(centerPointFromIndex(candidate, voxel_size));
+          const Point point = centerPointFromIndex(candidate, voxel_size);
+          if (overlap_it->second != RegionOverlap::kPartial ||
+              region.contains(point)) {
+            result.push_back(point);
+          }
           break;
         }
         case MapBase::VoxelState::kOccupied:
@@ -254,16 +914,7 @@ void SubmapFrontierEvaluator::computeFrontierCandidates(
       }
     }
   }
-  output->second = result;
-  auto t_end = std::chrono::high_resolution_clock::now();
-
-  // Logging
-  LOG_IF(INFO, config_.verbosity >= 2)
-      << "Found " << result.size() << " frontier candidates in submap "
-      << output->first << " in "
-      << std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start)
-             .count()
-      << "ms.";
+  return result;
 }
 
 SubmapFrontierEvaluator::Index SubmapFrontierEvaluator::indexFromPoint(
@@ -284,15 +935,21 @@ MapBase::VoxelState SubmapFrontierEvaluator::voxelState(
       index, layer.voxels_per_side(), &block_idx, &voxel_idx);
   const auto block = layer.getBlockPtrByIndex(block_idx);
   if (block) {
-    const voxblox::TsdfVoxel& voxel = block->getVoxelByVoxelIndex(voxel_idx);
-    if (voxel.weight > 1e-6) {
-      if (voxel.distance > layer.voxel_size()) {
-        // Note(schmluk): The surface is slightly inflated to make detection
-        // more conservative and avoid frontiers out in the blue.
-        return MapBase::VoxelState::kFree;
-      } else {
-        return MapBase::VoxelState::kOccupied;
-      }
+    return classifyVoxel(block->getVoxelByVoxelIndex(voxel_idx),
+                         layer.voxel_size());
+  }
+  return MapBase::VoxelState::kUnknown;
+}
+
+MapBase::VoxelState SubmapFrontierEvaluator::classifyVoxel(
+    const voxblox::TsdfVoxel& voxel, FloatingPoint voxel_size) {
+  if (voxel.weight > 1e-6) {
+    if (voxel.distance > voxel_size) {
+      // Note(schmluk): The surface is slightly inflated to make detection
+      // more conservative and avoid frontiers out in the blue.
+      return MapBase::VoxelState::kFree;
+    } else {
+      return MapBase::VoxelState::kOccupied;
     }
   }
   return MapBase::VoxelState::kUnknown;
@@ -47,6 +47,14 @@ bool BoundingBox::contains(const Point& point) {
   return point.z() >= config_.z_min;
 }
 
+bool BoundingBox::getBoundingBox(Point* min_corner, Point* max_corner) const {
+  CHECK_NOTNULL(min_corner);
+  CHECK_NOTNULL(max_corner);
+  *min_corner = Point(config_.x_min, config_.y_min, config_.z_min);
+  *max_corner = Point(config_.x_max, config_.y_max, config_.z_max);
+  return true;
+}
+
 BoundingBox::BoundingBox(const Config& config)
     : RegionOfInterest(), config_(config.checkValid()) {}
 
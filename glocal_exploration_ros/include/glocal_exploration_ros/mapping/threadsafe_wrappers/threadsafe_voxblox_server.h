@@ -3,6 +3,7 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
@@ -47,33 +48,31 @@ class ThreadsafeVoxbloxServer : public voxblox::EsdfServer {
     *safe_esdf_map_->getEsdfLayerPtr() = esdf_map_->getEsdfLayer();
 
     // Call the external callback, if it has been set
-    if (external_new_esdf_callback_) {
-      external_new_esdf_callback_();
-    }
+    callExternalCallback(external_new_esdf_callback_);
   }
   void updateEsdfBatch(bool full_euclidean = false) override {
     voxblox::EsdfServer::updateEsdfBatch();
     *safe_esdf_map_->getEsdfLayerPtr() = esdf_map_->getEsdfLayer();
 
     // Call the external callback, if it has been set
-    if (external_new_esdf_callback_) {
-      external_new_esdf_callback_();
-    }
+    callExternalCallback(external_new_esdf_callback_);
   }
 
   void newPoseCallback(const voxblox::Transformation& T_G_C) override {
     voxblox::EsdfServer::newPoseCallback(T_G_C);
 
     // Call the external callback, if it has been set
-    if (external_new_pose_callback_) {
-      external_new_pose_callback_();
-    }
+    callExternalCallback(external_new_pose_callback_);
   }
 
+  // NOTE: Once a callback is reset, it is guaranteed to no longer be running,
+  //       s.t. the objects it uses can safely be destroyed.
   void setExternalNewPoseCallback(Function callback) {
+    std::lock_guard<std::mutex> lock(external_callback_mutex_);
     external_new_pose_callback_ = std::move(callback);
   }
   void setExternalNewEsdfCallback(Function callback) {
+    std::lock_guard<std::mutex> lock(external_callback_mutex_);
     external_new_esdf_callback_ = std::move(callback);
   }
 
@@ -93,6 +92,14 @@ class ThreadsafeVoxbloxServer : public voxblox::EsdfServer {
 
   Function external_new_pose_callback_;
   Function external_new_esdf_callback_;
+  // Guards the external callbacks, which are called from the spinner thread.
+  std::mutex external_callback_mutex_;
+  void callExternalCallback(const Function& callback) {
+    std::lock_guard<std::mutex> lock(external_callback_mutex_);
+    if (callback) {
+      callback();
+    }
+  }
 
   ros::CallbackQueue callback_queue_;
   ros::AsyncSpinner spinner_;
@@ -2,6 +2,7 @@
 #define GLOCAL_EXPLORATION_ROS_MAPPING_VOXBLOX_MAP_H_
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -29,7 +30,7 @@ class VoxbloxMap : public MapBase {
 
   explicit VoxbloxMap(const Config& config,
                       const std::shared_ptr<Communicator>& communicator);
-  ~VoxbloxMap() override = default;
+  ~VoxbloxMap() override;
 
   /* General and Accessors */
   FloatingPoint getVoxelSize() const override { return c_voxel_size_; }
@@ -99,12 +100,21 @@ class VoxbloxMap : public MapBase {
       const Point& position) const override {
     return std::vector<SubmapId>({0u});
   }
+  // NOTE: The returned TSDF is a copy of the live TSDF, taken by the first
+  //       call after an ESDF update and reused until the next one. Later
+  //       calls therefore miss the pointclouds integrated after the copy,
+  //       lagging behind by up to one ESDF update period.
   std::vector<SubmapData> getAllSubmapData() override;
 
  protected:
   const Config config_;
   std::unique_ptr<ThreadsafeVoxbloxServer> server_;
 
+  // Copy of the TSDF shared with the global planner, until the next ESDF
+  // update.
+  std::shared_ptr<const voxblox::Layer<voxblox::TsdfVoxel>> tsdf_snapshot_;
+  std::mutex tsdf_snapshot_mutex_;
+
   // cached constants
   FloatingPoint c_block_size_;
   FloatingPoint c_voxel_size_;
@@ -1,20 +1,33 @@
 #ifndef GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_LOCAL_AREA_H_
 #define GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_LOCAL_AREA_H_
 
+#include <cstdint>
 #include <limits>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <voxgraph/common.h>
 #include <voxgraph/frontend/submap_collection/voxgraph_submap_collection.h>
 
 #include <glocal_exploration/mapping/map_base.h>
 #include <glocal_exploration/utils/frame_transformer.h>
+#include <glocal_exploration/utils/thread_pool.h>
 
 #include "glocal_exploration_ros/mapping/voxgraph_spatial_hash.h"
 
 namespace glocal_exploration {
+// Compact local area voxel, that only records how many overlapping submaps
+// observed it as free or as occupied. Since each submap contributes exactly
+// one count, deintegration is exact and can not drift.
+struct OccupancyCountVoxel {
+  uint8_t num_free_observations = 0u;
+  uint8_t num_occupied_observations = 0u;
+};
+
 class VoxgraphLocalArea {
  public:
   using SubmapId = voxgraph::SubmapID;
@@ -24,39 +37,128 @@ class VoxgraphLocalArea {
   using VoxelState = MapBase::VoxelState;
   using SubmapIdSet = std::set<SubmapId>;
 
-  explicit VoxgraphLocalArea(const voxblox::TsdfMap::Config& config)
-      : local_area_layer_(config.tsdf_voxel_size, config.tsdf_voxels_per_side),
-        fixed_frame_transformer_("submap_0") {}
+  // The voxel representation used to store the local area.
+  enum class Representation {
+    kTsdf,      // Full TSDF with weighted fusion of the submaps (default).
+    kOccupancy  // Compact per voxel occupancy counts.
+  };
+  static std::string representationToString(Representation representation);
+  // NOTE: Expects a valid name, which VoxgraphMap::Config::checkParams()
+  //       ensures.
+  static Representation representationFromString(
+      const std::string& representation);
+
+  struct Config {
+    int num_threads = 1;
+    // Maximum number of blocks kept in memory. Set to 0 to disable eviction.
+    size_t max_num_blocks = 0u;
+    // Blocks within this distance of the robot are never evicted.
+    FloatingPoint eviction_radius = 20.f;  // m
+  };
+
+  static std::unique_ptr<VoxgraphLocalArea> create(
+      Representation representation,
+      const voxblox::TsdfMap::Config& tsdf_config, const Config& config);
+  static size_t getVoxelMemorySize(Representation representation);
+
+  virtual ~VoxgraphLocalArea() = default;
+
+  virtual void update(
+      const voxgraph::VoxgraphSubmapCollection& submap_collection,
+      const VoxgraphSpatialHash& spatial_submap_id_hash,
+      const voxblox::EsdfMap& local_map, const Point& t_O_robot) = 0;
+  virtual void prune() = 0;
+
+  virtual VoxelState getVoxelStateAtPosition(const Point& position) const = 0;
+  virtual bool isObserved(const Point& position) const = 0;
+
+  virtual void publishLocalArea(ros::Publisher local_area_pub) = 0;
+
+ protected:
+  static constexpr FloatingPoint kTsdfObservedWeight = 1e-3;
+};
+
+template <typename VoxelType>
+class VoxgraphLocalAreaLayer : public VoxgraphLocalArea {
+ public:
+  VoxgraphLocalAreaLayer(const voxblox::TsdfMap::Config& tsdf_config,
+                         const Config& config)
+      : config_(config),
+        local_area_layer_(tsdf_config.tsdf_voxel_size,
+                          tsdf_config.tsdf_voxels_per_side),
+        fixed_frame_transformer_("submap_0"),
+        integration_workers_(config.num_threads - 1) {}
 
   void update(const voxgraph::VoxgraphSubmapCollection& submap_collection,
               const VoxgraphSpatialHash& spatial_submap_id_hash,
-              const voxblox::EsdfMap& local_map);
-  void prune();
+              const voxblox::EsdfMap& local_map,
+              const Point& t_O_robot) override;
+  void prune() override;
 
-  VoxelState getVoxelStateAtPosition(const Point& position);
-  bool isObserved(const Point& position);
-  bool isValidAtPosition(const Point& position);
+  VoxelState getVoxelStateAtPosition(const Point& position) const override;
+  bool isObserved(const Point& position) const override;
 
-  void publishLocalArea(ros::Publisher local_area_pub);
+  void publishLocalArea(ros::Publisher local_area_pub) override;
 
  protected:
-  static constexpr FloatingPoint kTsdfObservedWeight = 1e-3;
+  const Config config_;
 
   std::unordered_map<SubmapId, Transformation> submaps_in_local_area_;
-  voxblox::Layer<TsdfVoxel> local_area_layer_;
+  voxblox::Layer<VoxelType> local_area_layer_;
 
   FrameTransformer fixed_frame_transformer_;
 
-  void deintegrateSubmap(const SubmapId submap_id,
-                         const voxblox::Layer<TsdfVoxel>& submap_tsdf);
-  void integrateSubmap(const SubmapId submap_id,
-                       const Transformation& T_F_submap,
-                       const voxblox::Layer<TsdfVoxel>& submap_tsdf,
-                       bool deintegrate = false);
+  // Representation specific voxel operations
+  static void mergeSubmapVoxel(const TsdfVoxel& submap_voxel, bool deintegrate,
+                               FloatingPoint voxel_size,
+                               VoxelType* local_area_voxel);
+  static VoxelState getVoxelState(const VoxelType& voxel,
+                                  FloatingPoint voxel_size);
+  static float getVisualizationIntensity(const VoxelType& voxel);
+
+  // Bookkeeping used to evict blocks and to rematerialize them when needed
+  struct BlockInfo {
+    SubmapIdSet submap_ids;  // Submaps that overlap with the block
+    size_t last_used_tick = 0u;  // Last update in which it was near the robot
+    bool is_evicted = false;
+  };
+  voxblox::AnyIndexHashMapType<BlockInfo>::type block_info_;
+  size_t update_tick_ = 0u;
+  void evictAndRestoreBlocks(
+      const voxgraph::VoxgraphSubmapCollection& submap_collection,
+      const Point& t_F_robot);
+
+  // A submap that should be (de)integrated into the local area at a given pose
+  struct IntegrationJob {
+    SubmapId submap_id;
+    Transformation T_F_submap;
+    const voxblox::Layer<TsdfVoxel>* submap_tsdf;
+    bool deintegrate;
+  };
+  // Interpolates the submaps directly into the local area blocks they overlap.
+  // The work is split across threads by local area block, s.t. each block is
+  // only ever written by a single thread and no locking is needed.
+  void integrateSubmaps(const std::vector<IntegrationJob>& jobs);
+  void integrateSubmapsIntoBlocks(
+      const std::vector<IntegrationJob>& jobs,
+      const std::vector<std::pair<voxblox::Block<VoxelType>*,
+                                  const std::vector<size_t>*>>& block_list);
+  void integrateSubmapsIntoBlock(const std::vector<IntegrationJob>& jobs,
+                                 const std::vector<size_t>& job_indices,
+                                 voxblox::Block<VoxelType>* local_area_block);
 
   bool submapPoseChanged(const SubmapId submap_id,
                          const Transformation& T_F_submap_new);
+
+  // Workers for the integration, which the updating thread joins. They are
+  // kept alive, s.t. the updates do not spawn threads.
+  // NOTE: Declared last, s.t. the workers are joined before the members
+  //       above are destroyed.
+  ThreadPool integration_workers_;
 };
+
+using TsdfLocalArea = VoxgraphLocalAreaLayer<voxblox::TsdfVoxel>;
+using OccupancyLocalArea = VoxgraphLocalAreaLayer<OccupancyCountVoxel>;
 }  // namespace glocal_exploration
 
 #endif  // GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_LOCAL_AREA_H_
@@ -1,12 +1,18 @@
 #ifndef GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_MAP_H_
 #define GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_MAP_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <glocal_exploration/3rd_party/config_utilities.hpp>
 #include <glocal_exploration/mapping/map_base.h>
+#include <glocal_exploration/utils/thread_pool.h>
 
 #include "glocal_exploration_ros/mapping/threadsafe_wrappers/threadsafe_voxblox_server.h"
 #include "glocal_exploration_ros/mapping/threadsafe_wrappers/threadsafe_voxgraph_server.h"
@@ -25,6 +31,14 @@ class VoxgraphMap : public MapBase {
     FloatingPoint traversability_radius = 0.3f;  // m
     FloatingPoint clearing_radius = 0.5f;        // m
     int verbosity = 1;
+    int local_area_num_threads = 4;  // Used to (de)integrate submaps.
+    int global_map_num_threads = 4;  // Used for batched global map queries.
+    // Memory budget per local area buffer, set to 0 for unlimited.
+    FloatingPoint local_area_max_memory_mb = 0.f;
+    FloatingPoint local_area_eviction_radius = 20.f;  // m
+    // Either "tsdf" (weighted fusion) or "occupancy" (compact, majority vote
+    // of the overlapping submaps, which changes the traversability results).
+    std::string local_area_representation = "tsdf";
 
     Config();
     void checkParams() const override;
@@ -34,7 +48,7 @@ class VoxgraphMap : public MapBase {
 
   explicit VoxgraphMap(const Config& config,
                        const std::shared_ptr<Communicator>& communicator);
-  ~VoxgraphMap() override = default;
+  ~VoxgraphMap() override;
 
   /* General and Accessors */
   FloatingPoint getVoxelSize() const override { return c_voxel_size_; }
@@ -73,6 +87,8 @@ class VoxgraphMap : public MapBase {
 
   /* Global planner */
   bool isObservedInGlobalMap(const Point& position) override;
+  void areObservedInGlobalMap(const std::vector<Point>& positions,
+                              std::vector<bool>* is_observed) override;
   bool isTraversableInGlobalMap(
       const Point& position,
       const FloatingPoint traversability_radius) override;
@@ -96,6 +112,8 @@ class VoxgraphMap : public MapBase {
     return voxgraph_spatial_hash_.getSubmapsAtPosition(position);
   }
   std::vector<SubmapData> getAllSubmapData() override;
+  static SubmapData getSubmapData(
+      const voxgraph::VoxgraphSubmap::ConstPtr& submap);
 
  protected:
   const Config config_;
@@ -103,15 +121,33 @@ class VoxgraphMap : public MapBase {
   std::unique_ptr<ThreadsafeVoxbloxServer> voxblox_server_;
   std::unique_ptr<ThreadsafeVoxgraphServer> voxgraph_server_;
 
-  std::unique_ptr<VoxgraphLocalArea> local_area_;
-  bool local_area_needs_update_;
-  void updateLocalAreaIfNeeded();
+  // The local area is double buffered. Queries always read the front buffer,
+  // which is a complete snapshot, while the background worker brings the back
+  // buffer up to date and then swaps the two.
+  std::unique_ptr<VoxgraphLocalArea> local_area_front_;
+  std::unique_ptr<VoxgraphLocalArea> local_area_back_;
+  mutable std::shared_mutex local_area_swap_mutex_;
+  std::atomic<bool> local_area_needs_update_;
+  std::atomic<int> local_area_num_buffers_to_prune_;
+  bool local_area_shutdown_requested_;
+  std::mutex local_area_worker_mutex_;
+  std::condition_variable local_area_worker_condition_;
+  std::thread local_area_update_thread_;
+  void requestLocalAreaUpdate();
+  void requestLocalAreaPruning();
+  void localAreaUpdateLoop();
   static constexpr FloatingPoint local_area_pruning_period_s_ = 10.f;
   ros::Timer local_area_pruning_timer_;
   ros::Publisher local_area_pub_;
 
-  VoxgraphSpatialHash voxgraph_spatial_hash_;
+  // NOTE: The publisher is declared first s.t. it outlives the spatial hash's
+  //       background worker, whose update callback uses it.
   ros::Publisher voxgraph_spatial_hash_pub_;
+  VoxgraphSpatialHash voxgraph_spatial_hash_;
+
+  // Workers for the batched global map queries, which the calling thread
+  // joins. They are kept alive, s.t. the queries do not spawn threads.
+  ThreadPool global_map_query_workers_;
 
   // cached constants
   FloatingPoint c_block_size_;
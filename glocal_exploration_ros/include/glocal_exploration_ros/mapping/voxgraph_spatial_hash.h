@@ -1,10 +1,16 @@
 #ifndef GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_SPATIAL_HASH_H_
 #define GLOCAL_EXPLORATION_ROS_MAPPING_VOXGRAPH_SPATIAL_HASH_H_
 
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <voxgraph/frontend/submap_collection/voxgraph_submap_collection.h>
@@ -16,54 +22,101 @@
 namespace glocal_exploration {
 class VoxgraphSpatialHash {
  public:
+  using Function = std::function<void()>;
   using SubmapIdSet = std::set<voxgraph::SubmapID>;
   using UnorderedSubmapIdSet = std::unordered_set<voxgraph::SubmapID>;
 
   using SpatialSubmapIdHash =
       voxblox::AnyIndexHashMapType<UnorderedSubmapIdSet>::type;
 
-  VoxgraphSpatialHash() : fixed_frame_transformer_("submap_0") {}
+  VoxgraphSpatialHash();
+  ~VoxgraphSpatialHash();
 
   std::vector<voxgraph::SubmapID> getSubmapsAtPosition(
       const Point& position) const {
+    std::lock_guard<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
     const voxblox::Point t_F_block =
         fixed_frame_transformer_.transformFromOdomToFixedFrame(position);
     const auto mission_block_index =
         voxblox::getGridIndexFromPoint<voxblox::BlockIndex>(
             t_F_block, block_grid_size_inv_);
-    if (spatial_submap_id_hash_.count(mission_block_index)) {
-      std::lock_guard<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
-      const UnorderedSubmapIdSet& submap_id_set =
-          spatial_submap_id_hash_.at(mission_block_index);
-      std::vector<voxgraph::SubmapID> submap_id_vector(submap_id_set.begin(),
-                                                       submap_id_set.end());
-      return submap_id_vector;
+    const auto it = spatial_submap_id_hash_.find(mission_block_index);
+    if (it != spatial_submap_id_hash_.end()) {
+      return std::vector<voxgraph::SubmapID>(it->second.begin(),
+                                             it->second.end());
     } else {
       return std::vector<voxgraph::SubmapID>();
     }
   }
 
+  // The submaps (first) overlapping with each group of positions (second),
+  // s.t. each hash cell is only looked up once. Only the positions at the
+  // given indices are considered.
+  using SubmapsAndPositionIndices =
+      std::pair<std::vector<voxgraph::SubmapID>, std::vector<size_t>>;
+  std::vector<SubmapsAndPositionIndices> getSubmapsAtPositions(
+      const std::vector<Point>& positions,
+      const std::vector<size_t>& position_indices) const;
+
+  // Schedule an update of the hash on the background worker. Only the submap
+  // pointers and poses are copied here, s.t. the caller is not blocked.
   void update(const voxgraph::VoxgraphSubmapCollection& submap_collection);
 
+  // Optional callback that is invoked by the worker after each update.
+  void setUpdateFinishedCallback(Function callback) {
+    std::lock_guard<std::mutex> update_queue_lock(update_queue_mutex_);
+    update_finished_callback_ = std::move(callback);
+  }
+
   void publishSpatialHash(ros::Publisher spatial_hash_pub);
 
  private:
+  // Minimal copy of the submap collection's state, used by the worker.
+  struct SubmapSnapshot {
+    voxgraph::SubmapID id;
+    voxgraph::Transformation T_O_submap;
+    voxgraph::VoxgraphSubmap::ConstPtr submap_ptr;
+  };
+  struct CollectionSnapshot {
+    voxgraph::Transformation T_O_F;
+    std::vector<SubmapSnapshot> submaps;
+  };
+
+  // The pose at which each submap was hashed and the cells it occupies.
+  struct HashedSubmap {
+    voxgraph::Transformation T_F_submap;
+    voxblox::IndexSet cells;
+  };
+
   SpatialSubmapIdHash spatial_submap_id_hash_;
-  std::unordered_map<voxgraph::SubmapID, voxgraph::Transformation>
-      submaps_in_spatial_hash_;
   mutable std::mutex spatial_hash_mutex_;
 
+  // NOTE: Only accessed from the worker thread, so it need not be guarded.
+  std::unordered_map<voxgraph::SubmapID, HashedSubmap> submaps_in_spatial_hash_;
+
   FrameTransformer fixed_frame_transformer_;
 
   const float block_grid_size_ = 3.2;
   const float block_grid_size_inv_ = 1.f / block_grid_size_;
 
-  void removeSubmap(const voxgraph::SubmapID submap_id,
-                    const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf);
-  void addSubmap(const voxgraph::SubmapID submap_id,
-                 const voxgraph::Transformation& T_F_submap,
-                 const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf,
-                 const bool remove = false);
+  // Background worker. Only the most recent pending snapshot is kept, since
+  // each snapshot fully describes the collection.
+  std::unique_ptr<CollectionSnapshot> pending_update_;
+  Function update_finished_callback_;
+  bool shutdown_requested_ = false;
+  std::mutex update_queue_mutex_;
+  std::condition_variable update_queue_condition_;
+  std::thread update_thread_;
+  void updateLoop();
+
+  void processUpdate(const CollectionSnapshot& snapshot);
+  void updateSubmapCells(const voxgraph::SubmapID submap_id,
+                         const voxgraph::Transformation& T_F_submap,
+                         const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf);
+  voxblox::IndexSet computeSubmapCells(
+      const voxgraph::SubmapID submap_id,
+      const voxgraph::Transformation& T_F_submap,
+      const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf) const;
 
   bool submapPoseChanged(const voxgraph::SubmapID submap_id,
                          const voxgraph::Transformation& T_F_submap_new);
@@ -1,8 +1,10 @@
 #ifndef GLOCAL_EXPLORATION_ROS_PLANNING_GLOBAL_SKELETON_PLANNER_H_
 #define GLOCAL_EXPLORATION_ROS_PLANNING_GLOBAL_SKELETON_PLANNER_H_
 
+#include <chrono>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -43,6 +45,16 @@ class SkeletonPlanner : public SubmapFrontierEvaluator {
     // Frontier evaluator.
     SubmapFrontierEvaluator::Config submap_frontier_config;
     int max_closest_frontier_search_time_sec = 25;
+    // true: find the paths to all frontiers with a single search.
+    // false: run one A* search per frontier.
+    bool use_multi_goal_search = true;
+    // Reuse the observability of frontiers from skeleton vertices until the
+    // frontier or the submaps change.
+    bool cache_frontier_observability = true;
+    // Check the observability on the frontier summaries' representative
+    // points, with the number of points that need to be visible scaled down
+    // by the fraction of points that are checked.
+    bool use_representative_frontier_points = true;
 
     Config();
     void checkParams() const override;
@@ -52,11 +64,15 @@ class SkeletonPlanner : public SubmapFrontierEvaluator {
 
   // Frontier search data collection.
   struct FrontierSearchData {
+    int cluster_id = -1;
     Point centroid = Point(0.f, 0.f, 0.f);
     FloatingPoint euclidean_distance = 0.f;
     FloatingPoint path_distance = 0.f;
     int num_points = 0;
-    std::vector<Point> frontier_points;
+    // Points used to check the frontier's observability, owned by the
+    // SubmapFrontierEvaluator and valid until the frontiers are updated.
+    const std::vector<Point>* frontier_points = nullptr;
+    const std::vector<Point>* representative_points = nullptr;
     int clusters = 1;
     std::vector<RelativeWayPoint> way_points;
     enum Reachability {
@@ -116,11 +132,29 @@ class SkeletonPlanner : public SubmapFrontierEvaluator {
   bool computePathToFrontier(
       const Point& start_point,
       const std::vector<GlobalVertexId>& start_vertex_candidates,
-      const Point& frontier_centroid, const std::vector<Point>& frontier_points,
+      const FrontierSearchData& frontier,
       std::vector<RelativeWayPoint>* way_points,
       bool* frontier_is_observable = nullptr);
-  bool isFrontierPointObservableFromPosition(
-      const Point& frontier_point, const Point& skeleton_vertex_point);
+  // Evaluates all frontiers in frontier_data_ and sets the path of the closest
+  // one. Returns false if no frontier is reachable.
+  bool computePathsToAllFrontiers(
+      const Point& start_point,
+      const std::vector<GlobalVertexId>& start_vertex_candidates,
+      const std::chrono::high_resolution_clock::time_point& t_start,
+      int* unobservable_frontier_counter);
+  bool searchFrontierExitVertices(
+      const FrontierSearchData& frontier,
+      std::vector<GlobalVertexId>* end_vertex_candidates);
+  void convertToFrontierPath(const Point& start_point,
+                             const std::vector<GlobalVertexId>& vertex_path,
+                             const Point& frontier_centroid,
+                             std::vector<RelativeWayPoint>* way_points);
+  // Whether more than min_num_visible_frontier_points of the frontier points
+  // are visible from the position. If only the representative points are
+  // checked, the same fraction of them needs to be visible.
+  bool isFrontierObservableFromPosition(const FrontierSearchData& frontier,
+                                        const Point& skeleton_vertex_point);
+  void updateFrontierObservabilityCache();
   void clusterFrontiers();
   bool verifyNextWayPoints();
 
@@ -135,6 +169,19 @@ class SkeletonPlanner : public SubmapFrontierEvaluator {
   std::vector<FrontierSearchData> frontier_data_;
   VisualizationData vis_data_;
 
+  // Observability of the frontiers (by cluster id) from the skeleton vertices.
+  // Cleared whenever the link layer reports new or moved submaps.
+  using VertexAndClusterId = std::pair<GlobalVertexId, int>;
+  struct VertexAndClusterIdHash {
+    std::size_t operator()(const VertexAndClusterId& key) const {
+      return GlobalVertexIdHash()(key.first) * 31u +
+             static_cast<std::size_t>(key.second);
+    }
+  };
+  std::unordered_map<VertexAndClusterId, bool, VertexAndClusterIdHash>
+      frontier_observability_cache_;
+  int frontier_observability_cache_version_ = -1;
+
   // Stages of global planning.
   enum class Stage { k1ComputeFrontiers, k2ComputeGoalAndPath, k3ExecutePath };
   Stage stage_;
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <glocal_exploration/common.h>
@@ -32,6 +33,20 @@ VoxbloxMap::VoxbloxMap(const Config& config,
   // cache important values
   c_voxel_size_ = server_->getEsdfMapPtr()->voxel_size();
   c_block_size_ = server_->getEsdfMapPtr()->block_size();
+
+  // Drop the TSDF snapshot on each ESDF update, s.t. the next call to
+  // getAllSubmapData() copies the live TSDF again. It is not invalidated by
+  // the TSDF integration in between.
+  server_->setExternalNewEsdfCallback([&] {
+    std::lock_guard<std::mutex> tsdf_snapshot_lock(tsdf_snapshot_mutex_);
+    tsdf_snapshot_.reset();
+  });
+}
+
+VoxbloxMap::~VoxbloxMap() {
+  // Make sure the callback no longer accesses this object.
+  // NOTE: Resetting the callback waits for a running call to finish.
+  server_->setExternalNewEsdfCallback(nullptr);
 }
 
 bool VoxbloxMap::isTraversableInActiveSubmap(
@@ -198,8 +213,17 @@ std::vector<MapBase::SubmapData> VoxbloxMap::getAllSubmapData() {
   SubmapData datum;
   datum.id = 0;
   datum.T_M_S.setIdentity();
-  datum.tsdf_layer = std::make_shared<const voxblox::Layer<voxblox::TsdfVoxel>>(
-      server_->getTsdfMapPtr()->getTsdfLayer());
+  {
+    // NOTE: Since the map keeps changing, it needs to be copied. The snapshot
+    //       is shared by all callers until the ESDF is updated again.
+    std::lock_guard<std::mutex> tsdf_snapshot_lock(tsdf_snapshot_mutex_);
+    if (!tsdf_snapshot_) {
+      tsdf_snapshot_ =
+          std::make_shared<const voxblox::Layer<voxblox::TsdfVoxel>>(
+              server_->getTsdfMapPtr()->getTsdfLayer());
+    }
+    datum.tsdf_layer = tsdf_snapshot_;
+  }
   data.push_back(datum);
   return data;
 }
@@ -1,19 +1,158 @@
 #include "glocal_exploration_ros/mapping/voxgraph_local_area.h"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <pcl/conversions.h>
 #include <pcl/point_types.h>
 #include <pcl_conversions/pcl_conversions.h>
-#include <voxblox/utils/evaluation_utils.h>
+#include <voxblox/interpolator/interpolator.h>
 #include <voxblox_ros/ptcloud_vis.h>
 
 #include <glocal_exploration/utils/set_utils.h>
 
 namespace glocal_exploration {
 
-void VoxgraphLocalArea::update(
+std::string VoxgraphLocalArea::representationToString(
+    Representation representation) {
+  switch (representation) {
+    case Representation::kTsdf:
+      return "tsdf";
+    case Representation::kOccupancy:
+      return "occupancy";
+  }
+  return "unknown";
+}
+
+VoxgraphLocalArea::Representation VoxgraphLocalArea::representationFromString(
+    const std::string& representation) {
+  if (representation == "occupancy") {
+    return Representation::kOccupancy;
+  }
+  CHECK_EQ(representation, "tsdf")
+      << "Unknown local area representation '" << representation << "'.";
+  return Representation::kTsdf;
+}
+
+std::unique_ptr<VoxgraphLocalArea> VoxgraphLocalArea::create(
+    Representation representation, const voxblox::TsdfMap::Config& tsdf_config,
+    const Config& config) {
+  switch (representation) {
+    case Representation::kTsdf:
+      return std::make_unique<TsdfLocalArea>(tsdf_config, config);
+    case Representation::kOccupancy:
+      return std::make_unique<OccupancyLocalArea>(tsdf_config, config);
+  }
+  return nullptr;
+}
+
+size_t VoxgraphLocalArea::getVoxelMemorySize(Representation representation) {
+  switch (representation) {
+    case Representation::kTsdf:
+      return sizeof(TsdfVoxel);
+    case Representation::kOccupancy:
+      return sizeof(OccupancyCountVoxel);
+  }
+  return 0u;
+}
+
+template <>
+void TsdfLocalArea::mergeSubmapVoxel(const TsdfVoxel& submap_voxel,
+                                     bool deintegrate,
+                                     FloatingPoint /* voxel_size */,
+                                     TsdfVoxel* local_area_voxel) {
+  const float signed_submap_voxel_weight =
+      deintegrate ? -submap_voxel.weight : submap_voxel.weight;
+  const float combined_weight =
+      local_area_voxel->weight + signed_submap_voxel_weight;
+  if (combined_weight > kTsdfObservedWeight) {
+    local_area_voxel->distance =
+        (submap_voxel.distance * signed_submap_voxel_weight +
+         local_area_voxel->distance * local_area_voxel->weight) /
+        combined_weight;
+    local_area_voxel->weight = combined_weight;
+  } else {
+    local_area_voxel->distance = 0.f;
+    local_area_voxel->weight = 0.f;
+  }
+}
+
+template <>
+VoxgraphLocalArea::VoxelState TsdfLocalArea::getVoxelState(
+    const TsdfVoxel& voxel, FloatingPoint voxel_size) {
+  if (voxel.weight > kTsdfObservedWeight) {
+    if (voxel.distance > voxel_size) {
+      return VoxelState::kFree;
+    } else {
+      return VoxelState::kOccupied;
+    }
+  }
+  return VoxelState::kUnknown;
+}
+
+template <>
+float TsdfLocalArea::getVisualizationIntensity(const TsdfVoxel& voxel) {
+  return voxel.distance;
+}
+
+template <>
+void OccupancyLocalArea::mergeSubmapVoxel(
+    const TsdfVoxel& submap_voxel, bool deintegrate, FloatingPoint voxel_size,
+    OccupancyCountVoxel* local_area_voxel) {
+  // Classify the voxel the same way as for a single submap, and count it
+  // NOTE: The interpolated submap voxel is identical when the submap is later
+  //       deintegrated at the same pose, so the counts cancel out exactly.
+  if (submap_voxel.weight <= kTsdfObservedWeight) {
+    return;
+  }
+  uint8_t& count = (voxel_size < submap_voxel.distance)
+                       ? local_area_voxel->num_free_observations
+                       : local_area_voxel->num_occupied_observations;
+  if (deintegrate) {
+    DCHECK_LT(0u, count);
+    if (0u < count) {
+      --count;
+    }
+  } else {
+    LOG_IF(WARNING, count == std::numeric_limits<uint8_t>::max())
+        << "Local area voxel observation count saturated.";
+    if (count < std::numeric_limits<uint8_t>::max()) {
+      ++count;
+    }
+  }
+}
+
+template <>
+VoxgraphLocalArea::VoxelState OccupancyLocalArea::getVoxelState(
+    const OccupancyCountVoxel& voxel, FloatingPoint /* voxel_size */) {
+  // Majority vote, where ties are resolved conservatively
+  if (voxel.num_occupied_observations == 0u &&
+      voxel.num_free_observations == 0u) {
+    return VoxelState::kUnknown;
+  } else if (voxel.num_occupied_observations < voxel.num_free_observations) {
+    return VoxelState::kFree;
+  } else {
+    return VoxelState::kOccupied;
+  }
+}
+
+template <>
+float OccupancyLocalArea::getVisualizationIntensity(
+    const OccupancyCountVoxel& voxel) {
+  return static_cast<float>(voxel.num_free_observations) -
+         static_cast<float>(voxel.num_occupied_observations);
+}
+
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::update(
     const voxgraph::VoxgraphSubmapCollection& submap_collection,
     const VoxgraphSpatialHash& spatial_submap_id_hash,
-    const voxblox::EsdfMap& local_map) {
+    const voxblox::EsdfMap& local_map, const Point& t_O_robot) {
   // Update the transform from the odom to a fixed (non-robocentric) frame
   if (submap_collection.empty()) {
     return;
@@ -66,39 +205,142 @@ void VoxgraphLocalArea::update(
     }
   }
 
-  // Deintegrate submaps (at old pose)
+  // Deintegrate submaps (at old pose) and integrate submaps (at new pose)
+  // NOTE: The deintegrations are listed first, s.t. they are merged first.
+  std::vector<IntegrationJob> jobs;
   for (const SubmapId& submap_id : submaps_to_deintegrate) {
+    const auto& submap_it = submaps_in_local_area_.find(submap_id);
+    CHECK(submap_it != submaps_in_local_area_.end())
+        << "Could not find submap with ID: " << submap_id;
     const voxblox::Layer<TsdfVoxel>& submap_tsdf =
         submap_collection.getSubmap(submap_id).getTsdfMap().getTsdfLayer();
-    deintegrateSubmap(submap_id, submap_tsdf);
+    jobs.push_back(IntegrationJob{submap_id, submap_it->second, &submap_tsdf,
+                                  /* deintegrate= */ true});
   }
-
-  // Integrate submaps (at new pose)
   for (const SubmapId& submap_id : submaps_to_integrate) {
     const voxgraph::VoxgraphSubmap& submap =
         submap_collection.getSubmap(submap_id);
     const Transformation T_F_submap =
         fixed_frame_transformer_.transformFromOdomToFixedFrame(
             submap.getPose());
-    const voxblox::Layer<TsdfVoxel>& submap_tsdf =
-        submap.getTsdfMap().getTsdfLayer();
-    integrateSubmap(submap_id, T_F_submap, submap_tsdf);
+    jobs.push_back(IntegrationJob{submap_id, T_F_submap,
+                                  &submap.getTsdfMap().getTsdfLayer(),
+                                  /* deintegrate= */ false});
+  }
+  integrateSubmaps(jobs);
+
+  // Keep the memory usage bounded
+  if (0u < config_.max_num_blocks) {
+    evictAndRestoreBlocks(
+        submap_collection,
+        fixed_frame_transformer_.transformFromOdomToFixedFrame(t_O_robot));
   }
 }
 
-void VoxgraphLocalArea::prune() {
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::evictAndRestoreBlocks(
+    const voxgraph::VoxgraphSubmapCollection& submap_collection,
+    const Point& t_F_robot) {
+  ++update_tick_;
+  const FloatingPoint block_size = local_area_layer_.block_size();
+
+  // Refresh the blocks near the robot and find the evicted ones among them
+  voxblox::BlockIndexList blocks_to_restore;
+  for (auto& block_kv : block_info_) {
+    const Point t_F_block_center =
+        voxblox::getCenterPointFromGridIndex(block_kv.first, block_size);
+    if ((t_F_block_center - t_F_robot).norm() <= config_.eviction_radius) {
+      block_kv.second.last_used_tick = update_tick_;
+      if (block_kv.second.is_evicted) {
+        blocks_to_restore.emplace_back(block_kv.first);
+      }
+    }
+  }
+
+  // Rematerialize them from the submaps that overlap with them
+  if (!blocks_to_restore.empty()) {
+    std::vector<IntegrationJob> jobs;
+    std::unordered_map<SubmapId, size_t> submap_id_to_job_idx;
+    for (const auto& submap_kv : submaps_in_local_area_) {
+      submap_id_to_job_idx[submap_kv.first] = jobs.size();
+      jobs.push_back(IntegrationJob{
+          submap_kv.first, submap_kv.second,
+          &submap_collection.getSubmap(submap_kv.first)
+               .getTsdfMap()
+               .getTsdfLayer(),
+          /* deintegrate= */ false});
+    }
+
+    std::vector<std::vector<size_t>> block_job_indices;
+    block_job_indices.reserve(blocks_to_restore.size());
+    std::vector<
+        std::pair<voxblox::Block<VoxelType>*, const std::vector<size_t>*>>
+        block_list;
+    block_list.reserve(blocks_to_restore.size());
+    for (const voxblox::BlockIndex& block_index : blocks_to_restore) {
+      BlockInfo& block_info = block_info_.at(block_index);
+      block_info.is_evicted = false;
+      std::vector<size_t>& job_indices = block_job_indices.emplace_back();
+      for (const SubmapId submap_id : block_info.submap_ids) {
+        job_indices.push_back(submap_id_to_job_idx.at(submap_id));
+      }
+      block_list.emplace_back(
+          local_area_layer_.allocateBlockPtrByIndex(block_index).get(),
+          &job_indices);
+    }
+    integrateSubmapsIntoBlocks(jobs, block_list);
+  }
+
+  // Evict the least recently used blocks that are not near the robot, until
+  // the memory budget is met
+  size_t num_evicted_blocks = 0u;
+  const size_t num_allocated_blocks =
+      local_area_layer_.getNumberOfAllocatedBlocks();
+  if (config_.max_num_blocks < num_allocated_blocks) {
+    std::vector<std::pair<size_t, voxblox::BlockIndex>> eviction_candidates;
+    for (const auto& block_kv : block_info_) {
+      if (!block_kv.second.is_evicted &&
+          block_kv.second.last_used_tick < update_tick_) {
+        eviction_candidates.emplace_back(block_kv.second.last_used_tick,
+                                         block_kv.first);
+      }
+    }
+    std::sort(eviction_candidates.begin(), eviction_candidates.end(),
+              [](const auto& lhs, const auto& rhs) {
+                return lhs.first < rhs.first;
+              });
+    const size_t num_blocks_to_evict =
+        num_allocated_blocks - config_.max_num_blocks;
+    for (const auto& eviction_candidate : eviction_candidates) {
+      if (num_blocks_to_evict <= num_evicted_blocks) {
+        break;
+      }
+      local_area_layer_.removeBlock(eviction_candidate.second);
+      block_info_.at(eviction_candidate.second).is_evicted = true;
+      ++num_evicted_blocks;
+    }
+  }
+
+  VLOG(3) << "Local area: Restored " << blocks_to_restore.size()
+          << " and evicted " << num_evicted_blocks << " blocks, "
+          << local_area_layer_.getNumberOfAllocatedBlocks() << " of "
+          << block_info_.size() << " blocks are resident.";
+}
+
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::prune() {
   size_t num_pruned_blocks = 0u;
+  const FloatingPoint voxel_size = local_area_layer_.voxel_size();
   voxblox::BlockIndexList blocks_indices;
   local_area_layer_.getAllAllocatedBlocks(&blocks_indices);
   for (const voxblox::BlockIndex& block_index : blocks_indices) {
-    const voxblox::Block<TsdfVoxel>& block =
+    const voxblox::Block<VoxelType>& block =
         local_area_layer_.getBlockByIndex(block_index);
     bool block_contains_observed_voxels = false;
     for (size_t linear_index = 0u; linear_index < block.num_voxels();
          ++linear_index) {
-      const voxblox::TsdfVoxel& voxel =
-          block.getVoxelByLinearIndex(linear_index);
-      if (kTsdfObservedWeight < voxel.weight) {
+      const VoxelType& voxel = block.getVoxelByLinearIndex(linear_index);
+      if (getVoxelState(voxel, voxel_size) != VoxelState::kUnknown) {
         block_contains_observed_voxels = true;
         break;
       }
@@ -112,54 +354,51 @@ void VoxgraphLocalArea::prune() {
   VLOG(3) << "Pruned " << num_pruned_blocks << " local area blocks";
 }
 
-VoxgraphLocalArea::VoxelState VoxgraphLocalArea::getVoxelStateAtPosition(
-    const Point& position) {
+template <typename VoxelType>
+VoxgraphLocalArea::VoxelState
+VoxgraphLocalAreaLayer<VoxelType>::getVoxelStateAtPosition(
+    const Point& position) const {
   const voxblox::Point t_F_position =
       fixed_frame_transformer_.transformFromOdomToFixedFrame(position);
-  TsdfVoxel* voxel_ptr =
+  const VoxelType* voxel_ptr =
       local_area_layer_.getVoxelPtrByCoordinates(t_F_position);
   if (voxel_ptr) {
-    if (voxel_ptr->weight > kTsdfObservedWeight) {
-      if (voxel_ptr->distance > local_area_layer_.voxel_size()) {
-        return VoxelState::kFree;
-      } else {
-        return VoxelState::kOccupied;
-      }
-    }
+    return getVoxelState(*voxel_ptr, local_area_layer_.voxel_size());
   }
   return VoxelState::kUnknown;
 }
 
-bool VoxgraphLocalArea::isObserved(const Point& position) {
-  const voxblox::Point t_F_position =
-      fixed_frame_transformer_.transformFromOdomToFixedFrame(position);
-  TsdfVoxel* voxel_ptr =
-      local_area_layer_.getVoxelPtrByCoordinates(t_F_position);
-  return voxel_ptr && voxblox::utils::isObservedVoxel(*voxel_ptr);
+template <typename VoxelType>
+bool VoxgraphLocalAreaLayer<VoxelType>::isObserved(
+    const Point& position) const {
+  return getVoxelStateAtPosition(position) != VoxelState::kUnknown;
 }
 
-void VoxgraphLocalArea::publishLocalArea(ros::Publisher local_area_pub) {
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::publishLocalArea(
+    ros::Publisher local_area_pub) {
   pcl::PointCloud<pcl::PointXYZI> local_area_pointcloud_msg;
   local_area_pointcloud_msg.header.stamp = ros::Time::now().toNSec() / 1000ull;
   local_area_pointcloud_msg.header.frame_id =
       fixed_frame_transformer_.getFixedFrameId();
 
+  const FloatingPoint voxel_size = local_area_layer_.voxel_size();
   voxblox::BlockIndexList block_indices;
   local_area_layer_.getAllAllocatedBlocks(&block_indices);
   for (const voxblox::BlockIndex& block_index : block_indices) {
-    const voxblox::Block<TsdfVoxel>& block =
+    const voxblox::Block<VoxelType>& block =
         local_area_layer_.getBlockByIndex(block_index);
     for (voxblox::IndexElement linear_voxel_index = 0;
          linear_voxel_index < block.num_voxels(); ++linear_voxel_index) {
-      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(linear_voxel_index);
-      if (voxel.weight > kTsdfObservedWeight) {
+      const VoxelType& voxel = block.getVoxelByLinearIndex(linear_voxel_index);
+      if (getVoxelState(voxel, voxel_size) != VoxelState::kUnknown) {
         pcl::PointXYZI point_msg;
         const Point voxel_position =
             block.computeCoordinatesFromLinearIndex(linear_voxel_index);
         point_msg.x = voxel_position.x();
         point_msg.y = voxel_position.y();
         point_msg.z = voxel_position.z();
-        point_msg.intensity = voxel.distance;
+        point_msg.intensity = getVisualizationIntensity(voxel);
         local_area_pointcloud_msg.push_back(point_msg);
       }
     }
@@ -168,75 +407,172 @@ void VoxgraphLocalArea::publishLocalArea(ros::Publisher local_area_pub) {
   local_area_pub.publish(local_area_pointcloud_msg);
 }
 
-void VoxgraphLocalArea::deintegrateSubmap(
-    const SubmapId submap_id, const voxblox::Layer<TsdfVoxel>& submap_tsdf) {
-  const auto& submap_it = submaps_in_local_area_.find(submap_id);
-  CHECK(submap_it != submaps_in_local_area_.end())
-      << "Could not find submap with ID: " << submap_id;
-  const Transformation& T_F_submap_old = submap_it->second;
-  integrateSubmap(submap_id, T_F_submap_old, submap_tsdf, true);
-}
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::integrateSubmaps(
+    const std::vector<IntegrationJob>& jobs) {
+  if (jobs.empty()) {
+    return;
+  }
 
-void VoxgraphLocalArea::integrateSubmap(
-    const SubmapId submap_id,
-    const VoxgraphLocalArea::Transformation& T_F_submap,
-    const voxblox::Layer<TsdfVoxel>& submap_tsdf, const bool deintegrate) {
-  LOG(INFO) << "Local area: " << (deintegrate ? "Deintegrating" : "Integrating")
-            << " submap " << submap_id;
-
-  voxblox::Layer<TsdfVoxel> world_frame_submap_tsdf(
-      submap_tsdf.voxel_size(), submap_tsdf.voxels_per_side());
-  voxblox::transformLayer(submap_tsdf, T_F_submap, &world_frame_submap_tsdf);
-
-  voxblox::BlockIndexList submap_blocks;
-  world_frame_submap_tsdf.getAllAllocatedBlocks(&submap_blocks);
-  for (const voxblox::BlockIndex& submap_block_index : submap_blocks) {
-    const voxblox::Block<TsdfVoxel>& submap_block =
-        world_frame_submap_tsdf.getBlockByIndex(submap_block_index);
-    voxblox::Block<TsdfVoxel>::Ptr local_area_block =
-        local_area_layer_.allocateBlockPtrByIndex(submap_block_index);
-    CHECK(local_area_block) << "Local area block allocation failed";
+  // Find the local area blocks that each submap overlaps with
+  const FloatingPoint block_size = local_area_layer_.block_size();
+  const FloatingPoint block_size_inv = 1.f / block_size;
+  voxblox::AnyIndexHashMapType<std::vector<size_t>>::type block_to_jobs_map;
+  for (size_t job_idx = 0u; job_idx < jobs.size(); ++job_idx) {
+    const IntegrationJob& job = jobs[job_idx];
+    LOG(INFO) << "Local area: "
+              << (job.deintegrate ? "Deintegrating" : "Integrating")
+              << " submap " << job.submap_id;
 
-    for (voxblox::IndexElement linear_voxel_index = 0;
-         linear_voxel_index < submap_block.num_voxels(); ++linear_voxel_index) {
-      TsdfVoxel& local_area_voxel =
-          local_area_block->getVoxelByLinearIndex(linear_voxel_index);
-      const TsdfVoxel& submap_voxel =
-          submap_block.getVoxelByLinearIndex(linear_voxel_index);
-
-      float signed_submap_voxel_weight;
-      if (deintegrate) {
-        signed_submap_voxel_weight = -submap_voxel.weight;
-      } else {
-        signed_submap_voxel_weight = submap_voxel.weight;
+    voxblox::BlockIndexList submap_blocks;
+    job.submap_tsdf->getAllAllocatedBlocks(&submap_blocks);
+    for (const voxblox::BlockIndex& submap_block_index : submap_blocks) {
+      // Get the AABB of the block's corners in local area block indices
+      const Point t_submap_block_origin =
+          voxblox::getOriginPointFromGridIndex(submap_block_index,
+                                               job.submap_tsdf->block_size());
+      voxblox::BlockIndex aabb_min_idx =
+          voxblox::BlockIndex::Constant(std::numeric_limits<int>::max());
+      voxblox::BlockIndex aabb_max_idx =
+          voxblox::BlockIndex::Constant(std::numeric_limits<int>::lowest());
+      for (int corner_idx = 0; corner_idx < 8; ++corner_idx) {
+        const Point corner_offset(corner_idx & 1, (corner_idx >> 1) & 1,
+                                  (corner_idx >> 2) & 1);
+        const Point t_F_corner =
+            job.T_F_submap * (t_submap_block_origin +
+                              job.submap_tsdf->block_size() * corner_offset);
+        const voxblox::BlockIndex corner_block_index =
+            voxblox::getGridIndexFromPoint<voxblox::BlockIndex>(
+                t_F_corner, block_size_inv);
+        aabb_min_idx = aabb_min_idx.cwiseMin(corner_block_index);
+        aabb_max_idx = aabb_max_idx.cwiseMax(corner_block_index);
       }
 
-      float combined_weight =
-          local_area_voxel.weight + signed_submap_voxel_weight;
-      if (combined_weight > kTsdfObservedWeight) {
-        local_area_voxel.distance =
-            (submap_voxel.distance * signed_submap_voxel_weight +
-             local_area_voxel.distance * local_area_voxel.weight) /
-            combined_weight;
-        local_area_voxel.weight = combined_weight;
+      for (int idx_x = aabb_min_idx.x(); idx_x <= aabb_max_idx.x(); ++idx_x) {
+        for (int idx_y = aabb_min_idx.y(); idx_y <= aabb_max_idx.y(); ++idx_y) {
+          for (int idx_z = aabb_min_idx.z(); idx_z <= aabb_max_idx.z();
+               ++idx_z) {
+            std::vector<size_t>& block_jobs =
+                block_to_jobs_map[voxblox::BlockIndex(idx_x, idx_y, idx_z)];
+            if (block_jobs.empty() || block_jobs.back() != job_idx) {
+              block_jobs.push_back(job_idx);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Update the bookkeeping of which submaps overlap with which block
+  for (const auto& block_kv : block_to_jobs_map) {
+    SubmapIdSet& block_submap_ids = block_info_[block_kv.first].submap_ids;
+    for (const size_t job_idx : block_kv.second) {
+      if (jobs[job_idx].deintegrate) {
+        block_submap_ids.erase(jobs[job_idx].submap_id);
       } else {
-        local_area_voxel.distance = 0.f;
-        local_area_voxel.weight = 0.f;
+        block_submap_ids.insert(jobs[job_idx].submap_id);
       }
     }
   }
 
+  // Allocate all the affected blocks upfront, since the layer's block hash
+  // can not safely be modified concurrently
+  // NOTE: Evicted blocks are skipped, they are rebuilt from their overlapping
+  //       submaps if they are needed again.
+  std::vector<std::pair<voxblox::Block<VoxelType>*, const std::vector<size_t>*>>
+      block_list;
+  block_list.reserve(block_to_jobs_map.size());
+  for (const auto& block_kv : block_to_jobs_map) {
+    auto block_info_it = block_info_.find(block_kv.first);
+    if (block_info_it->second.submap_ids.empty()) {
+      // No submap overlaps with this block anymore
+      local_area_layer_.removeBlock(block_kv.first);
+      block_info_.erase(block_info_it);
+      continue;
+    }
+    if (block_info_it->second.is_evicted) {
+      continue;
+    }
+    if (!local_area_layer_.hasBlock(block_kv.first)) {
+      block_info_it->second.last_used_tick = update_tick_;
+    }
+    voxblox::Block<VoxelType>::Ptr local_area_block =
+        local_area_layer_.allocateBlockPtrByIndex(block_kv.first);
+    CHECK(local_area_block) << "Local area block allocation failed";
+    block_list.emplace_back(local_area_block.get(), &block_kv.second);
+  }
+  integrateSubmapsIntoBlocks(jobs, block_list);
+
   // Update the record of what submaps currently are in the local area
-  if (deintegrate) {
-    submaps_in_local_area_.erase(submap_id);
-  } else {
-    submaps_in_local_area_.emplace(submap_id, T_F_submap);
+  for (const IntegrationJob& job : jobs) {
+    if (job.deintegrate) {
+      submaps_in_local_area_.erase(job.submap_id);
+    } else {
+      submaps_in_local_area_[job.submap_id] = job.T_F_submap;
+    }
   }
 }
 
-bool VoxgraphLocalArea::submapPoseChanged(
-    const VoxgraphLocalArea::SubmapId submap_id,
-    const VoxgraphLocalArea::Transformation& T_F_submap_new) {
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::integrateSubmapsIntoBlocks(
+    const std::vector<IntegrationJob>& jobs,
+    const std::vector<std::pair<voxblox::Block<VoxelType>*,
+                                const std::vector<size_t>*>>& block_list) {
+  // Merge the submaps into the blocks in parallel
+  std::atomic<size_t> next_block_idx{0u};
+  auto integration_worker = [&]() {
+    size_t block_idx;
+    while ((block_idx = next_block_idx++) < block_list.size()) {
+      integrateSubmapsIntoBlock(jobs, *block_list[block_idx].second,
+                                block_list[block_idx].first);
+    }
+  };
+  std::vector<std::future<void>> integration_results;
+  for (int thread_idx = 1; thread_idx < config_.num_threads; ++thread_idx) {
+    integration_results.emplace_back(
+        integration_workers_.enqueue(integration_worker));
+  }
+  integration_worker();
+  for (std::future<void>& integration_result : integration_results) {
+    integration_result.wait();
+  }
+}
+
+template <typename VoxelType>
+void VoxgraphLocalAreaLayer<VoxelType>::integrateSubmapsIntoBlock(
+    const std::vector<IntegrationJob>& jobs,
+    const std::vector<size_t>& job_indices,
+    voxblox::Block<VoxelType>* local_area_block) {
+  CHECK_NOTNULL(local_area_block);
+  const FloatingPoint voxel_size = local_area_block->voxel_size();
+  for (const size_t job_idx : job_indices) {
+    const IntegrationJob& job = jobs[job_idx];
+    const Transformation T_submap_F = job.T_F_submap.inverse();
+    const voxblox::Interpolator<TsdfVoxel> interpolator(job.submap_tsdf);
+
+    for (voxblox::IndexElement linear_voxel_index = 0;
+         linear_voxel_index < local_area_block->num_voxels();
+         ++linear_voxel_index) {
+      // Look up the submap's TSDF at the voxel's position
+      const Point t_submap_voxel =
+          T_submap_F * local_area_block->computeCoordinatesFromLinearIndex(
+                           linear_voxel_index);
+      TsdfVoxel submap_voxel;
+      if (!interpolator.getVoxel(t_submap_voxel, &submap_voxel, true)) {
+        continue;
+      }
+
+      // Merge it into the local area
+      mergeSubmapVoxel(
+          submap_voxel, job.deintegrate, voxel_size,
+          &local_area_block->getVoxelByLinearIndex(linear_voxel_index));
+    }
+  }
+}
+
+template <typename VoxelType>
+bool VoxgraphLocalAreaLayer<VoxelType>::submapPoseChanged(
+    const SubmapId submap_id, const Transformation& T_F_submap_new) {
   const auto& submap_old_it = submaps_in_local_area_.find(submap_id);
   if (submap_old_it == submaps_in_local_area_.end()) {
     LOG(WARNING) << "Requested whether a submap moved even though it has not "
@@ -255,4 +591,7 @@ bool VoxgraphLocalArea::submapPoseChanged(
           kAngleThresholdRad < angle_delta);
 }
 
+template class VoxgraphLocalAreaLayer<voxblox::TsdfVoxel>;
+template class VoxgraphLocalAreaLayer<OccupancyCountVoxel>;
+
 }  // namespace glocal_exploration
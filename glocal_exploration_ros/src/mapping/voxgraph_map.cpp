@@ -1,8 +1,14 @@
 #include "glocal_exploration_ros/mapping/voxgraph_map.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <future>
 #include <limits>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -21,12 +27,25 @@ VoxgraphMap::Config::Config() { setConfigName("VoxgraphMap"); }
 
 void VoxgraphMap::Config::checkParams() const {
   checkParamGT(traversability_radius, 0.f, "traversability_radius");
+  checkParamGT(local_area_num_threads, 0, "local_area_num_threads");
+  checkParamGT(global_map_num_threads, 0, "global_map_num_threads");
+  checkParamGE(local_area_max_memory_mb, 0.f, "local_area_max_memory_mb");
+  checkParamGT(local_area_eviction_radius, 0.f, "local_area_eviction_radius");
+  checkParamCond(local_area_representation == "occupancy" ||
+                     local_area_representation == "tsdf",
+                 "local_area_representation is expected to be 'occupancy' or "
+                 "'tsdf'.");
 }
 
 void VoxgraphMap::Config::fromRosParam() {
   rosParam("traversability_radius", &traversability_radius);
   rosParam("clearing_radius", &clearing_radius);
   rosParam("verbosity", &verbosity);
+  rosParam("local_area_num_threads", &local_area_num_threads);
+  rosParam("global_map_num_threads", &global_map_num_threads);
+  rosParam("local_area_max_memory_mb", &local_area_max_memory_mb);
+  rosParam("local_area_eviction_radius", &local_area_eviction_radius);
+  rosParam("local_area_representation", &local_area_representation);
   nh_private_namespace = rosParamNameSpace();
 }
 
@@ -34,6 +53,11 @@ void VoxgraphMap::Config::printFields() const {
   printField("verbosity", verbosity);
   printField("clearing_radius", clearing_radius);
   printField("traversability_radius", traversability_radius);
+  printField("local_area_num_threads", local_area_num_threads);
+  printField("global_map_num_threads", global_map_num_threads);
+  printField("local_area_max_memory_mb", local_area_max_memory_mb);
+  printField("local_area_eviction_radius", local_area_eviction_radius);
+  printField("local_area_representation", local_area_representation);
   printField("nh_private_namespace", nh_private_namespace);
 }
 
@@ -41,7 +65,10 @@ VoxgraphMap::VoxgraphMap(const Config& config,
                          const std::shared_ptr<Communicator>& communicator)
     : MapBase(communicator),
       config_(config.checkValid()),
-      local_area_needs_update_(false) {
+      local_area_needs_update_(false),
+      local_area_num_buffers_to_prune_(0),
+      local_area_shutdown_requested_(false),
+      global_map_query_workers_(config_.global_map_num_threads - 1) {
   LOG_IF(INFO, config_.verbosity >= 1) << "\n" + config_.toString();
   // Launch the sliding window local map and global map servers
   ros::NodeHandle nh(ros::names::parentNamespace(config_.nh_private_namespace));
@@ -50,28 +77,52 @@ VoxgraphMap::VoxgraphMap(const Config& config,
   voxgraph_server_ = std::make_unique<ThreadsafeVoxgraphServer>(nh, nh_private);
 
   // Setup the local area
-  local_area_ = std::make_unique<VoxgraphLocalArea>(
-      voxblox::getTsdfMapConfigFromRosParam(nh_private));
-  voxblox_server_->setExternalNewEsdfCallback(
-      [&] { local_area_needs_update_ = true; });
+  const voxblox::TsdfMap::Config local_area_tsdf_config =
+      voxblox::getTsdfMapConfigFromRosParam(nh_private);
+  const VoxgraphLocalArea::Representation local_area_representation =
+      VoxgraphLocalArea::representationFromString(
+          config_.local_area_representation);
+  VoxgraphLocalArea::Config local_area_config;
+  local_area_config.num_threads = config_.local_area_num_threads;
+  local_area_config.eviction_radius = config_.local_area_eviction_radius;
+  const size_t local_area_block_memory_bytes =
+      std::pow(local_area_tsdf_config.tsdf_voxels_per_side, 3) *
+      VoxgraphLocalArea::getVoxelMemorySize(local_area_representation);
+  local_area_config.max_num_blocks = static_cast<size_t>(
+      config_.local_area_max_memory_mb * 1e6 / local_area_block_memory_bytes);
+  local_area_front_ = VoxgraphLocalArea::create(
+      local_area_representation, local_area_tsdf_config, local_area_config);
+  local_area_back_ = VoxgraphLocalArea::create(
+      local_area_representation, local_area_tsdf_config, local_area_config);
   local_area_pub_ = nh_private.advertise<pcl::PointCloud<pcl::PointXYZI>>(
       "local_area", 1, true);
-  local_area_pruning_timer_ = nh_private.createTimer(
-      ros::Duration(local_area_pruning_period_s_),
-      std::bind(&VoxgraphLocalArea::prune, local_area_.get()));
+  local_area_update_thread_ =
+      std::thread(&VoxgraphMap::localAreaUpdateLoop, this);
+  voxblox_server_->setExternalNewEsdfCallback(
+      [&] { requestLocalAreaUpdate(); });
+  local_area_pruning_timer_ =
+      nh_private.createTimer(ros::Duration(local_area_pruning_period_s_),
+                             [&](const ros::TimerEvent&) {
+                               requestLocalAreaPruning();
+                             });
 
   // Setup the spatial hash
   voxgraph_spatial_hash_pub_ =
       nh_private.advertise<visualization_msgs::MarkerArray>("spatial_hash", 1,
                                                             true);
+  // NOTE: The spatial hash is updated in the background. Once it changed, the
+  //       set of submaps overlapping with the local area might have changed.
+  voxgraph_spatial_hash_.setUpdateFinishedCallback([&] {
+    requestLocalAreaUpdate();
+    if (0 < voxgraph_spatial_hash_pub_.getNumSubscribers()) {
+      voxgraph_spatial_hash_.publishSpatialHash(voxgraph_spatial_hash_pub_);
+    }
+  });
 
   // Setup the new voxgraph submap callback
   voxgraph_server_->setExternalNewSubmapCallback([&] {
-    // Update the spatial submap ID hash
+    // Schedule an update of the spatial submap ID hash
     voxgraph_spatial_hash_.update(voxgraph_server_->getSubmapCollection());
-    if (0 < voxgraph_spatial_hash_pub_.getNumSubscribers()) {
-      voxgraph_spatial_hash_.publishSpatialHash(voxgraph_spatial_hash_pub_);
-    }
 
     // If the global planner is a frontier based planner we compute the frontier
     // candidates every time a submap is finished to reduce overhead when
@@ -79,15 +130,11 @@ VoxgraphMap::VoxgraphMap(const Config& config,
     auto frontier_evaluator =
         dynamic_cast<SubmapFrontierEvaluator*>(comm_->globalPlanner().get());
     if (frontier_evaluator) {
-      SubmapData datum;
-      datum.id = voxgraph_server_->getSubmapCollection().getLastSubmapId();
-      // Copy construct the submap s.t. the local are
-      datum.tsdf_layer =
-          std::make_shared<const voxblox::Layer<voxblox::TsdfVoxel>>(
-              voxgraph_server_->getSubmapCollection()
-                  .getSubmap(datum.id)
-                  .getTsdfMap()
-                  .getTsdfLayer());
+      const voxgraph::SubmapID submap_id =
+          voxgraph_server_->getSubmapCollection().getLastSubmapId();
+      SubmapData datum = getSubmapData(
+          voxgraph_server_->getSubmapCollection().getSubmapConstPtr(
+              submap_id));
       Point initial_point(0.0, 0.0, 0.0);  // The origin is always free space.
       frontier_evaluator->computeFrontiersForSubmap(datum, initial_point);
     }
@@ -153,21 +200,77 @@ MapBase::VoxelState VoxgraphMap::getVoxelStateInLocalArea(
     return VoxelState::kOccupied;
   }
 
-  updateLocalAreaIfNeeded();
-  return local_area_->getVoxelStateAtPosition(position);
+  std::shared_lock<std::shared_mutex> local_area_lock(local_area_swap_mutex_);
+  return local_area_front_->getVoxelStateAtPosition(position);
+}
+
+VoxgraphMap::~VoxgraphMap() {
+  // Stop the local area worker and make sure it can no longer be woken up.
+  // NOTE: Resetting the callback waits for a running call to finish.
+  voxblox_server_->setExternalNewEsdfCallback(nullptr);
+  voxgraph_spatial_hash_.setUpdateFinishedCallback(nullptr);
+  {
+    std::lock_guard<std::mutex> worker_lock(local_area_worker_mutex_);
+    local_area_shutdown_requested_ = true;
+  }
+  local_area_worker_condition_.notify_all();
+  if (local_area_update_thread_.joinable()) {
+    local_area_update_thread_.join();
+  }
+}
+
+void VoxgraphMap::requestLocalAreaUpdate() {
+  {
+    std::lock_guard<std::mutex> worker_lock(local_area_worker_mutex_);
+    local_area_needs_update_ = true;
+  }
+  local_area_worker_condition_.notify_one();
 }
 
-void VoxgraphMap::updateLocalAreaIfNeeded() {
-  if (local_area_needs_update_) {
-    CHECK_NOTNULL(local_area_);
+void VoxgraphMap::requestLocalAreaPruning() {
+  {
+    std::lock_guard<std::mutex> worker_lock(local_area_worker_mutex_);
+    local_area_num_buffers_to_prune_ = 2;
+  }
+  local_area_worker_condition_.notify_one();
+}
 
-    local_area_->update(voxgraph_server_->getSubmapCollection(),
-                        voxgraph_spatial_hash_,
-                        *voxblox_server_->getEsdfMapPtr());
-    local_area_needs_update_ = false;
+void VoxgraphMap::localAreaUpdateLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> worker_lock(local_area_worker_mutex_);
+      local_area_worker_condition_.wait(worker_lock, [this] {
+        return local_area_shutdown_requested_ || local_area_needs_update_ ||
+               0 < local_area_num_buffers_to_prune_;
+      });
+      if (local_area_shutdown_requested_) {
+        return;
+      }
+      local_area_needs_update_ = false;
+    }
 
+    // Bring the back buffer up to date. Since it is never read by queries,
+    // this happens without holding the swap lock.
+    // NOTE: The back buffer is one update behind the front buffer, but since
+    //       the local area tracks which submaps it contains at which pose, it
+    //       simply catches up on both updates at once.
+    if (0 < local_area_num_buffers_to_prune_) {
+      local_area_back_->prune();
+      --local_area_num_buffers_to_prune_;
+    }
+    const Point robot_position = comm_->currentPose().position;
+    local_area_back_->update(voxgraph_server_->getSubmapCollection(),
+                             voxgraph_spatial_hash_,
+                             *voxblox_server_->getEsdfMapPtr(), robot_position);
     if (0 < local_area_pub_.getNumSubscribers()) {
-      local_area_->publishLocalArea(local_area_pub_);
+      local_area_back_->publishLocalArea(local_area_pub_);
+    }
+
+    // Publish it as the new snapshot
+    {
+      std::unique_lock<std::shared_mutex> local_area_lock(
+          local_area_swap_mutex_);
+      std::swap(local_area_front_, local_area_back_);
     }
   }
 }
@@ -179,9 +282,12 @@ bool VoxgraphMap::isObservedInGlobalMap(const Point& position) {
   }
 
   // Then fall back to local area
-  updateLocalAreaIfNeeded();
-  if (local_area_->isObserved(position)) {
-    return true;
+  {
+    std::shared_lock<std::shared_mutex> local_area_lock(
+        local_area_swap_mutex_);
+    if (local_area_front_->isObserved(position)) {
+      return true;
+    }
   }
 
   // As a last resort, check the submaps in the global map that overlap with
@@ -200,6 +306,93 @@ bool VoxgraphMap::isObservedInGlobalMap(const Point& position) {
   return false;
 }
 
+void VoxgraphMap::areObservedInGlobalMap(const std::vector<Point>& positions,
+                                         std::vector<bool>* is_observed) {
+  CHECK_NOTNULL(is_observed);
+  // NOTE: std::vector<bool> can not be written concurrently, so the workers
+  //       write into a byte per position instead.
+  std::vector<uint8_t> observed_flags(positions.size(), 0u);
+
+  // Start by checking the state in active submap and local area
+  std::vector<size_t> remaining_position_indices;
+  {
+    std::shared_lock<std::shared_mutex> local_area_lock(
+        local_area_swap_mutex_);
+    for (size_t position_idx = 0u; position_idx < positions.size();
+         ++position_idx) {
+      const Point& position = positions[position_idx];
+      if (voxblox_server_->getEsdfMapPtr()->isObserved(
+              position.cast<double>()) ||
+          local_area_front_->isObserved(position)) {
+        observed_flags[position_idx] = 1u;
+      } else {
+        remaining_position_indices.push_back(position_idx);
+      }
+    }
+  }
+
+  // Group the remaining positions by spatial hash cell, and look up each
+  // overlapping submap and its inverse pose only once
+  struct SubmapQueryData {
+    voxgraph::VoxgraphSubmap::ConstPtr submap_ptr;
+    Transformation T_S_M;
+  };
+  const std::vector<VoxgraphSpatialHash::SubmapsAndPositionIndices> cells =
+      voxgraph_spatial_hash_.getSubmapsAtPositions(positions,
+                                                   remaining_position_indices);
+  std::unordered_map<voxgraph::SubmapID, SubmapQueryData> submaps;
+  std::vector<std::vector<const SubmapQueryData*>> cell_submaps(cells.size());
+  for (size_t cell_idx = 0u; cell_idx < cells.size(); ++cell_idx) {
+    for (const voxgraph::SubmapID submap_id : cells[cell_idx].first) {
+      auto it = submaps.find(submap_id);
+      if (it == submaps.end()) {
+        voxgraph::VoxgraphSubmap::ConstPtr submap_ptr =
+            voxgraph_server_->getSubmapCollection().getSubmapConstPtr(
+                submap_id);
+        if (!submap_ptr) {
+          continue;
+        }
+        const Transformation T_S_M = submap_ptr->getPose().inverse();
+        it = submaps.emplace(submap_id,
+                             SubmapQueryData{std::move(submap_ptr), T_S_M})
+                 .first;
+      }
+      cell_submaps[cell_idx].push_back(&it->second);
+    }
+  }
+
+  // Check the submaps cell by cell in parallel
+  std::atomic<size_t> next_cell_idx{0u};
+  auto query_worker = [&]() {
+    size_t cell_idx;
+    while ((cell_idx = next_cell_idx++) < cells.size()) {
+      for (const SubmapQueryData* submap : cell_submaps[cell_idx]) {
+        const voxblox::EsdfMap& submap_esdf = submap->submap_ptr->getEsdfMap();
+        for (const size_t position_idx : cells[cell_idx].second) {
+          if (!observed_flags[position_idx] &&
+              submap_esdf.isObserved(
+                  (submap->T_S_M * positions[position_idx]).cast<double>())) {
+            observed_flags[position_idx] = 1u;
+          }
+        }
+      }
+    }
+  };
+  std::vector<std::future<void>> query_results;
+  const int num_threads = std::min(config_.global_map_num_threads,
+                                   static_cast<int>(cells.size()));
+  for (int thread_idx = 1; thread_idx < num_threads; ++thread_idx) {
+    query_results.emplace_back(
+        global_map_query_workers_.enqueue(query_worker));
+  }
+  query_worker();
+  for (std::future<void>& query_result : query_results) {
+    query_result.wait();
+  }
+
+  is_observed->assign(observed_flags.begin(), observed_flags.end());
+}
+
 bool VoxgraphMap::isTraversableInGlobalMap(
     const Point& position, const FloatingPoint traversability_radius) {
   if (!comm_->regionOfInterest()->contains(position)) {
@@ -207,13 +400,13 @@ bool VoxgraphMap::isTraversableInGlobalMap(
   }
 
   // Discard early if the point isn't traversable in the local area.
-  // NOTE: It's not worth it to update the local area just for this. So only
-  //       do it if it already happens to be ready.
-  if (!local_area_needs_update_) {
-    // NOTE: We can only check whether the local area is not occupied. Since the
-    //       local area only consists of a TSDF (no ESDF) and the traversability
-    //       radius generally exceeds the TSDF truncation distance.
-    if (local_area_->getVoxelStateAtPosition(position) ==
+  // NOTE: We can only check whether the local area is not occupied. Since the
+  //       local area only consists of a TSDF (no ESDF) and the traversability
+  //       radius generally exceeds the TSDF truncation distance.
+  {
+    std::shared_lock<std::shared_mutex> local_area_lock(
+        local_area_swap_mutex_);
+    if (local_area_front_->getVoxelStateAtPosition(position) ==
         VoxelState::kOccupied) {
       return false;
     }
@@ -252,17 +445,26 @@ std::vector<MapBase::SubmapData> VoxgraphMap::getAllSubmapData() {
   // directly use them by returning a pointer.
   std::vector<SubmapData> data;
   auto submaps = voxgraph_server_->getSubmapCollection().getSubmapConstPtrs();
+  data.reserve(submaps.size());
   for (const auto& submap : submaps) {
-    SubmapData datum;
-    datum.id = submap->getID();
-    datum.T_M_S = submap->getPose();
-    datum.tsdf_layer = std::make_shared<voxblox::Layer<voxblox::TsdfVoxel>>(
-        submap->getTsdfMap().getTsdfLayer());
-    data.push_back(datum);
+    data.push_back(getSubmapData(submap));
   }
   return data;
 }
 
+MapBase::SubmapData VoxgraphMap::getSubmapData(
+    const voxgraph::VoxgraphSubmap::ConstPtr& submap) {
+  CHECK_NOTNULL(submap);
+  SubmapData datum;
+  datum.id = submap->getID();
+  datum.T_M_S = submap->getPose();
+  // NOTE: The layer pointer shares ownership of the submap, s.t. the layer
+  //       stays valid without having to copy it.
+  datum.tsdf_layer = std::shared_ptr<const voxblox::Layer<voxblox::TsdfVoxel>>(
+      submap, &submap->getTsdfMap().getTsdfLayer());
+  return datum;
+}
+
 bool VoxgraphMap::isLineTraversableInActiveSubmap(
     const Point& start_point, const Point& end_point,
     const FloatingPoint traversability_radius, Point* last_traversable_point,
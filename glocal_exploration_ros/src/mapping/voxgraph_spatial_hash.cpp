@@ -1,5 +1,6 @@
 #include "glocal_exploration_ros/mapping/voxgraph_spatial_hash.h"
 
+#include <memory>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -10,72 +11,133 @@
 
 namespace glocal_exploration {
 
+VoxgraphSpatialHash::VoxgraphSpatialHash()
+    : fixed_frame_transformer_("submap_0"),
+      update_thread_(&VoxgraphSpatialHash::updateLoop, this) {}
+
+VoxgraphSpatialHash::~VoxgraphSpatialHash() {
+  {
+    std::lock_guard<std::mutex> update_queue_lock(update_queue_mutex_);
+    shutdown_requested_ = true;
+  }
+  update_queue_condition_.notify_all();
+  if (update_thread_.joinable()) {
+    update_thread_.join();
+  }
+}
+
 void VoxgraphSpatialHash::update(
     const voxgraph::VoxgraphSubmapCollection& submap_collection) {
-  // Update the transform from the odom to a fixed (non-robocentric) frame
   if (submap_collection.empty()) {
     return;
   }
-  fixed_frame_transformer_.update(
+
+  // Take a lightweight snapshot of the submap collection. The submaps
+  // themselves are frozen, so sharing their pointers with the worker is safe.
+  auto snapshot = std::make_unique<CollectionSnapshot>();
+  snapshot->T_O_F =
       submap_collection.getSubmap(submap_collection.getFirstSubmapId())
-          .getPose());
+          .getPose();
+  for (const voxgraph::VoxgraphSubmap::ConstPtr& submap_ptr :
+       submap_collection.getSubmapConstPtrs()) {
+    snapshot->submaps.push_back(
+        SubmapSnapshot{submap_ptr->getID(), submap_ptr->getPose(), submap_ptr});
+  }
 
-  // Get the submap IDs that used to be in the collection
-  SubmapIdSet submap_ids_in_spatial_hash;
-  for (const auto& submap_kv : submaps_in_spatial_hash_) {
-    submap_ids_in_spatial_hash.emplace(submap_kv.first);
+  // Hand it over to the worker, replacing any update that is still pending
+  {
+    std::lock_guard<std::mutex> update_queue_lock(update_queue_mutex_);
+    pending_update_ = std::move(snapshot);
   }
+  update_queue_condition_.notify_one();
+}
 
-  // Get the submap IDs that are currently in the collection
-  SubmapIdSet submap_ids_in_submap_collection;
-  for (const voxgraph::VoxgraphSubmap::ConstPtr& submap_ptr :
-       submap_collection.getSubmapConstPtrs()) {
-    submap_ids_in_submap_collection.emplace(submap_ptr->getID());
+void VoxgraphSpatialHash::updateLoop() {
+  while (true) {
+    std::unique_ptr<CollectionSnapshot> snapshot;
+    Function update_finished_callback;
+    {
+      std::unique_lock<std::mutex> update_queue_lock(update_queue_mutex_);
+      update_queue_condition_.wait(update_queue_lock, [this] {
+        return shutdown_requested_ || pending_update_ != nullptr;
+      });
+      if (shutdown_requested_) {
+        return;
+      }
+      snapshot = std::move(pending_update_);
+      update_finished_callback = update_finished_callback_;
+    }
+
+    processUpdate(*snapshot);
+
+    if (update_finished_callback) {
+      update_finished_callback();
+    }
   }
+}
 
-  // Add the new submaps to the spatial hash
-  SubmapIdSet submaps_to_add = set_utils::setDifference(
-      submap_ids_in_submap_collection, submap_ids_in_spatial_hash);
-  for (const voxgraph::SubmapID submap_id : submaps_to_add) {
-    const voxgraph::VoxgraphSubmap& submap =
-        submap_collection.getSubmap(submap_id);
-    const voxgraph::Transformation T_F_submap =
-        fixed_frame_transformer_.transformFromOdomToFixedFrame(
-            submap.getPose());
-    const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf =
-        submap.getTsdfMap().getTsdfLayer();
-    //    ROS_INFO_STREAM("Adding submap: " << submap_id);
-    addSubmap(submap_id, T_F_submap, submap_tsdf);
+void VoxgraphSpatialHash::processUpdate(const CollectionSnapshot& snapshot) {
+  // Update the transform from the odom to a fixed (non-robocentric) frame
+  {
+    std::lock_guard<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
+    fixed_frame_transformer_.update(snapshot.T_O_F);
   }
 
   // NOTE: Submaps are currently never deleted from the submap collection,
   //       we therefore don't check for this. If we wanted to add this in the
-  //       future, we should store smart pointers to the submaps (or at least
-  //       their TSDFs) s.t. they can properly be removed from the hash.
-
-  // Update the submaps that moved by removing them at the old pose and
-  // adding them again at their new pose
-  for (const voxgraph::SubmapID submap_id : submap_ids_in_spatial_hash) {
-    const voxgraph::VoxgraphSubmap& submap =
-        submap_collection.getSubmap(submap_id);
+  //       future, we could simply remove all cells stored in its HashedSubmap.
+
+  // Add the new submaps and move the submaps whose pose changed
+  // significantly. Submaps that did not move are not touched.
+  for (const SubmapSnapshot& submap : snapshot.submaps) {
     const voxgraph::Transformation T_F_submap_new =
         fixed_frame_transformer_.transformFromOdomToFixedFrame(
-            submap.getPose());
-    if (submapPoseChanged(submap_id, T_F_submap_new)) {
-      const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf =
-          submap.getTsdfMap().getTsdfLayer();
-      //      ROS_INFO_STREAM("Moving submap: " << submap_id);
-      removeSubmap(submap_id, submap_tsdf);
-      addSubmap(submap_id, T_F_submap_new, submap_tsdf);
+            submap.T_O_submap);
+    if (!submaps_in_spatial_hash_.count(submap.id) ||
+        submapPoseChanged(submap.id, T_F_submap_new)) {
+      updateSubmapCells(submap.id, T_F_submap_new,
+                        submap.submap_ptr->getTsdfMap().getTsdfLayer());
     }
   }
 }
 
+std::vector<VoxgraphSpatialHash::SubmapsAndPositionIndices>
+VoxgraphSpatialHash::getSubmapsAtPositions(
+    const std::vector<Point>& positions,
+    const std::vector<size_t>& position_indices) const {
+  std::lock_guard<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
+  // Group the positions by cell
+  voxblox::AnyIndexHashMapType<std::vector<size_t>>::type cell_to_positions;
+  for (const size_t position_idx : position_indices) {
+    const voxblox::Point t_F_position =
+        fixed_frame_transformer_.transformFromOdomToFixedFrame(
+            positions[position_idx]);
+    cell_to_positions[voxblox::getGridIndexFromPoint<voxblox::BlockIndex>(
+                          t_F_position, block_grid_size_inv_)]
+        .push_back(position_idx);
+  }
+
+  // Look up the submaps of each non-empty cell
+  std::vector<SubmapsAndPositionIndices> result;
+  result.reserve(cell_to_positions.size());
+  for (auto& cell_kv : cell_to_positions) {
+    const auto it = spatial_submap_id_hash_.find(cell_kv.first);
+    if (it == spatial_submap_id_hash_.end()) {
+      continue;
+    }
+    result.emplace_back(
+        std::vector<voxgraph::SubmapID>(it->second.begin(), it->second.end()),
+        std::move(cell_kv.second));
+  }
+  return result;
+}
+
 void VoxgraphSpatialHash::publishSpatialHash(ros::Publisher spatial_hash_pub) {
   ros::Time current_time = ros::Time::now();
   voxblox::ExponentialOffsetIdColorMap submap_id_color_map;
   std::unordered_map<voxgraph::SubmapID, visualization_msgs::Marker> marker_map;
 
+  std::unique_lock<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
   for (const auto& block_kv : spatial_submap_id_hash_) {
     const voxblox::BlockIndex& block_index = block_kv.first;
     geometry_msgs::Point position_msg;
@@ -89,6 +151,7 @@ void VoxgraphSpatialHash::publishSpatialHash(ros::Publisher spatial_hash_pub) {
       marker_map[submap_id].points.push_back(position_msg);
     }
   }
+  spatial_hash_lock.unlock();
 
   visualization_msgs::MarkerArray marker_array;
   for (auto& marker_kv : marker_map) {
@@ -116,35 +179,60 @@ void VoxgraphSpatialHash::publishSpatialHash(ros::Publisher spatial_hash_pub) {
   spatial_hash_pub.publish(marker_array);
 }
 
-void VoxgraphSpatialHash::removeSubmap(
+void VoxgraphSpatialHash::updateSubmapCells(
     const voxgraph::SubmapID submap_id,
+    const voxgraph::Transformation& T_F_submap,
     const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf) {
-  const auto& submap_it = submaps_in_spatial_hash_.find(submap_id);
-  CHECK(submap_it != submaps_in_spatial_hash_.end());
-  const voxgraph::Transformation& T_F_submap_old = submap_it->second;
-  addSubmap(submap_id, T_F_submap_old, submap_tsdf, true);
-}
+  // Compute the cells the submap overlaps with at its new pose
+  // NOTE: This is the expensive part, and it happens without holding the lock
+  voxblox::IndexSet new_cells =
+      computeSubmapCells(submap_id, T_F_submap, submap_tsdf);
 
-void VoxgraphSpatialHash::addSubmap(
-    const voxgraph::SubmapID submap_id,
-    const voxgraph::Transformation& T_F_submap,
-    const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf, const bool remove) {
-  LOG(INFO) << "Spatial hash: " << (remove ? "Removing" : "Adding")
-            << " submap " << submap_id;
-  if (remove) {
-    if (!submaps_in_spatial_hash_.count(submap_id)) {
-      LOG(ERROR) << "Spatial hash: Tried to remove submap that currently isn't "
-                    "in the spatial hash. This should never happen.";
-      return;
+  // Diff them against the cells it used to occupy, if any
+  HashedSubmap& hashed_submap = submaps_in_spatial_hash_[submap_id];
+  const bool is_new_submap = hashed_submap.cells.empty();
+  voxblox::BlockIndexList cells_to_remove;
+  for (const voxblox::BlockIndex& old_cell : hashed_submap.cells) {
+    if (!new_cells.count(old_cell)) {
+      cells_to_remove.emplace_back(old_cell);
+    }
+  }
+  voxblox::BlockIndexList cells_to_add;
+  for (const voxblox::BlockIndex& new_cell : new_cells) {
+    if (!hashed_submap.cells.count(new_cell)) {
+      cells_to_add.emplace_back(new_cell);
+    }
+  }
+  LOG(INFO) << "Spatial hash: " << (is_new_submap ? "Adding" : "Moving")
+            << " submap " << submap_id << " (" << cells_to_add.size()
+            << " cells added, " << cells_to_remove.size() << " removed)";
+
+  // Only touch the cells that changed
+  {
+    std::lock_guard<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
+    for (const voxblox::BlockIndex& cell : cells_to_remove) {
+      auto cell_it = spatial_submap_id_hash_.find(cell);
+      if (cell_it != spatial_submap_id_hash_.end()) {
+        cell_it->second.erase(submap_id);
+        if (cell_it->second.empty()) {
+          spatial_submap_id_hash_.erase(cell_it);
+        }
+      }
     }
-  } else {
-    if (submaps_in_spatial_hash_.count(submap_id)) {
-      LOG(ERROR) << "Spatial hash: Tried to add submap that is already "
-                    "in the spatial hash. This should never happen.";
-      return;
+    for (const voxblox::BlockIndex& cell : cells_to_add) {
+      spatial_submap_id_hash_[cell].insert(submap_id);
     }
   }
 
+  // Update the record of where the submap currently is in the spatial hash
+  hashed_submap.T_F_submap = T_F_submap;
+  hashed_submap.cells = std::move(new_cells);
+}
+
+voxblox::IndexSet VoxgraphSpatialHash::computeSubmapCells(
+    const voxgraph::SubmapID submap_id,
+    const voxgraph::Transformation& T_F_submap,
+    const voxblox::Layer<voxblox::TsdfVoxel>& submap_tsdf) const {
   // Precompute the overlapping indices based on the AABB
   std::vector<voxblox::BlockIndex> colliding_index_offsets;
   {
@@ -194,12 +282,13 @@ void VoxgraphSpatialHash::addSubmap(
       }
     }
   }
-  ROS_INFO_STREAM("Spatial hash block index offset count for submap "
-                  << submap_id << ": " << colliding_index_offsets.size());
+  VLOG(3) << "Spatial hash block index offset count for submap " << submap_id
+          << ": " << colliding_index_offsets.size();
 
   voxblox::BlockIndexList submap_blocks;
   submap_tsdf.getAllAllocatedBlocks(&submap_blocks);
-  std::lock_guard<std::mutex> spatial_hash_lock(spatial_hash_mutex_);
+  voxblox::IndexSet submap_cells;
+  submap_cells.reserve(submap_blocks.size() * colliding_index_offsets.size());
   for (const voxblox::BlockIndex& submap_block_index : submap_blocks) {
     const voxblox::Point t_submap_block_center =
         voxblox::getCenterPointFromGridIndex(submap_block_index,
@@ -212,22 +301,10 @@ void VoxgraphSpatialHash::addSubmap(
 
     for (const voxblox::BlockIndex& colliding_index_offset :
          colliding_index_offsets) {
-      UnorderedSubmapIdSet& submap_id_set =
-          spatial_submap_id_hash_[mission_block_index + colliding_index_offset];
-      if (remove) {
-        submap_id_set.erase(submap_id);
-      } else {
-        submap_id_set.insert(submap_id);
-      }
+      submap_cells.insert(mission_block_index + colliding_index_offset);
     }
   }
-
-  // Update the record of what submaps currently are in the spatial hash
-  if (remove) {
-    submaps_in_spatial_hash_.erase(submap_id);
-  } else {
-    submaps_in_spatial_hash_.emplace(submap_id, T_F_submap);
-  }
+  return submap_cells;
 }
 
 bool VoxgraphSpatialHash::submapPoseChanged(
@@ -239,7 +316,8 @@ bool VoxgraphSpatialHash::submapPoseChanged(
                     "yet been integrated. This should never happen.";
     return false;
   }
-  const voxgraph::Transformation& T_F_submap_old = submap_old_it->second;
+  const voxgraph::Transformation& T_F_submap_old =
+      submap_old_it->second.T_F_submap;
 
   const voxgraph::Transformation pose_delta =
       T_F_submap_old.inverse() * T_F_submap_new;
@@ -1,9 +1,11 @@
 #include "glocal_exploration_ros/planning/global/skeleton_planner.h"
 
 #include <algorithm>
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -34,6 +36,10 @@ void SkeletonPlanner::Config::fromRosParam() {
            &max_replan_attempts_to_chosen_frontier);
   rosParam("max_closest_frontier_search_time_sec",
            &max_closest_frontier_search_time_sec);
+  rosParam("use_multi_goal_search", &use_multi_goal_search);
+  rosParam("cache_frontier_observability", &cache_frontier_observability);
+  rosParam("use_representative_frontier_points",
+           &use_representative_frontier_points);
   rosParam("sensor_vertical_fov_rad", &sensor_vertical_fov_rad);
   rosParam("backtracking_distance_m", &backtracking_distance_m);
   nh_private_namespace = rosParamNameSpace() + "/skeleton";
@@ -52,6 +58,10 @@ void SkeletonPlanner::Config::printFields() const {
   printField("submap_frontier_config", submap_frontier_config);
   printField("max_closest_frontier_search_time_sec",
              max_closest_frontier_search_time_sec);
+  printField("use_multi_goal_search", use_multi_goal_search);
+  printField("cache_frontier_observability", cache_frontier_observability);
+  printField("use_representative_frontier_points",
+             use_representative_frontier_points);
   printField("max_replan_attempts_to_chosen_frontier",
              max_replan_attempts_to_chosen_frontier);
   printField("sensor_vertical_fov_rad", sensor_vertical_fov_rad);
@@ -181,24 +191,27 @@ bool SkeletonPlanner::computeGoalPoint() {
   // Compute the frontier with the shortest path to it.
   auto t_start = std::chrono::high_resolution_clock::now();
 
+  // Bring the links between the submap skeletons up to date.
+  skeleton_a_star_.updateLinkLayer();
+
   // Get all frontiers.
   frontier_data_.clear();
-  for (const auto& frontier : getActiveFrontiers()) {
+  // NOTE: The summaries are ordered the same way as the active frontiers.
+  const std::vector<FrontierSummary>& summaries = getActiveFrontierSummaries();
+  for (size_t i = 0u; i < summaries.size(); ++i) {
     FrontierSearchData& data = frontier_data_.emplace_back();
-    // Compute centroids and number of points.
-    for (const Point& point : frontier) {
-      data.centroid += point;
-      data.num_points++;
-    }
-    data.centroid /= data.num_points;
-    // NOTE(schmluk): Currently copy the frontiers since it's not that many.
-    data.frontier_points = frontier;
+    data.cluster_id = summaries[i].cluster_id;
+    data.centroid = summaries[i].centroid;
+    data.num_points = summaries[i].num_points;
+    data.frontier_points = &getActiveFrontiers()[i];
+    data.representative_points = &summaries[i].representative_points;
   }
   if (frontier_data_.empty()) {
     LOG(WARNING) << "No active frontiers found to compute goal points from.";
     vis_data_.execution_finished = true;
     return false;
   }
+  updateFrontierObservabilityCache();
 
   // Frontier clustering.
   if (config_.use_centroid_clustering) {
@@ -224,56 +237,69 @@ bool SkeletonPlanner::computeGoalPoint() {
                 return lhs.euclidean_distance < rhs.euclidean_distance;
               });
 
-    // Compute paths to frontiers to determine the closest reachable one. Start
-    // with closest and use euclidean distance as lower bound to prune
-    // candidates.
-    FloatingPoint shortest_path = std::numeric_limits<FloatingPoint>::max();
-    bool time_exceeded = false;
-    for (auto& candidate : frontier_data_) {
-      if (!time_exceeded &&
-          config_.max_closest_frontier_search_time_sec <
-              std::chrono::duration_cast<std::chrono::seconds>(
-                  std::chrono::high_resolution_clock::now() - t_start)
-                  .count()) {
-        LOG_IF(INFO, config_.verbosity >= 1)
-            << "Maximum closest frontier searching time exceeded. Will "
-               "continue with the frontiers we found so far.";
-        time_exceeded = true;
-      }
+    if (config_.use_multi_goal_search) {
+      // Compute the paths to all frontiers with a single search.
+      found_a_valid_path = computePathsToAllFrontiers(
+          start_point, start_vertex_candidates, t_start,
+          &unobservable_frontier_counter);
+      path_counter = std::count_if(
+          frontier_data_.begin(), frontier_data_.end(),
+          [](const FrontierSearchData& frontier) {
+            return frontier.reachability == FrontierSearchData::kReachable ||
+                   frontier.reachability == FrontierSearchData::kUnreachable;
+          });
+    } else {
+      // Compute paths to frontiers to determine the closest reachable one.
+      // Start with closest and use euclidean distance as lower bound to prune
+      // candidates.
+      FloatingPoint shortest_path = std::numeric_limits<FloatingPoint>::max();
+      bool time_exceeded = false;
+      for (auto& candidate : frontier_data_) {
+        if (!time_exceeded &&
+            config_.max_closest_frontier_search_time_sec <
+                std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::high_resolution_clock::now() - t_start)
+                    .count()) {
+          LOG_IF(INFO, config_.verbosity >= 1)
+              << "Maximum closest frontier searching time exceeded. Will "
+                 "continue with the frontiers we found so far.";
+          time_exceeded = true;
+        }
 
-      if (time_exceeded || candidate.euclidean_distance >= shortest_path) {
-        // These points can never be closer than what we already have.
-        candidate.path_distance = std::numeric_limits<FloatingPoint>::max();
-        candidate.reachability = FrontierSearchData::kUnchecked;
-      } else {
-        // Try to find a path via linked skeleton planning.
-        path_counter++;
-        std::vector<RelativeWayPoint> way_points;
-        bool frontier_is_observable = false;
-        if (computePathToFrontier(start_point, start_vertex_candidates,
-                                  candidate.centroid, candidate.frontier_points,
-                                  &way_points, &frontier_is_observable)) {
-          // Frontier is reachable, save path and compute path length.
-          candidate.way_points = way_points;
-          candidate.path_distance =
-              (way_points[0].getGlobalPosition() - current_robot_position)
-                  .norm();
-          for (size_t i = 1; i < way_points.size(); ++i) {
-            candidate.path_distance += (way_points[i].getGlobalPosition() -
-                                        way_points[i - 1].getGlobalPosition())
-                                           .norm();
-          }
-          shortest_path = std::min(shortest_path, candidate.path_distance);
-          candidate.reachability = FrontierSearchData::kReachable;
-          found_a_valid_path = true;
-        } else {
-          // Inaccessible frontier.
+        if (time_exceeded || candidate.euclidean_distance >= shortest_path) {
+          // These points can never be closer than what we already have.
           candidate.path_distance = std::numeric_limits<FloatingPoint>::max();
-          if (frontier_is_observable) {
-            candidate.reachability = FrontierSearchData::kUnreachable;
+          candidate.reachability = FrontierSearchData::kUnchecked;
+        } else {
+          // Try to find a path via linked skeleton planning.
+          path_counter++;
+          std::vector<RelativeWayPoint> way_points;
+          bool frontier_is_observable = false;
+          if (computePathToFrontier(start_point, start_vertex_candidates,
+                                    candidate, &way_points,
+                                    &frontier_is_observable)) {
+            // Frontier is reachable, save path and compute path length.
+            candidate.way_points = way_points;
+            candidate.path_distance =
+                (way_points[0].getGlobalPosition() - current_robot_position)
+                    .norm();
+            for (size_t i = 1; i < way_points.size(); ++i) {
+              candidate.path_distance += (way_points[i].getGlobalPosition() -
+                                          way_points[i - 1].getGlobalPosition())
+                                             .norm();
+            }
+            shortest_path = std::min(shortest_path, candidate.path_distance);
+            candidate.reachability = FrontierSearchData::kReachable;
+            found_a_valid_path = true;
           } else {
-            ++unobservable_frontier_counter;
-            candidate.reachability = FrontierSearchData::kInvalidGoal;
+            // Inaccessible frontier.
+            candidate.path_distance = std::numeric_limits<FloatingPoint>::max();
+            if (frontier_is_observable) {
+              candidate.reachability = FrontierSearchData::kUnreachable;
+            } else {
+              ++unobservable_frontier_counter;
+              candidate.reachability = FrontierSearchData::kInvalidGoal;
+            }
           }
         }
       }
@@ -621,7 +647,8 @@ bool SkeletonPlanner::searchSkeletonStartVertices(
       skeleton_a_star_.searchClosestReachableSkeletonVertices(
           *start_point,
           skeleton_a_star_.getConfig().max_num_start_vertex_candidates,
-          [&](const Point& start_point, const Point& end_point) {
+          [&](const Point& start_point, const GlobalVertexId&,
+              const Point& end_point) {
             return map->isLineTraversableInActiveSubmap(start_point, end_point,
                                                         traversability_radius);
           });
@@ -632,7 +659,8 @@ bool SkeletonPlanner::searchSkeletonStartVertices(
         skeleton_a_star_.searchClosestReachableSkeletonVertices(
             *start_point,
             skeleton_a_star_.getConfig().max_num_start_vertex_candidates,
-            [&](const Point& start_point, const Point& end_point) {
+            [&](const Point& start_point, const GlobalVertexId&,
+                const Point& end_point) {
               return map->isLineTraversableInGlobalMap(start_point, end_point,
                                                        traversability_radius);
             });
@@ -650,54 +678,183 @@ bool SkeletonPlanner::searchSkeletonStartVertices(
 bool SkeletonPlanner::computePathToFrontier(
     const Point& start_point,
     const std::vector<GlobalVertexId>& start_vertex_candidates,
-    const Point& frontier_centroid, const std::vector<Point>& frontier_points,
+    const FrontierSearchData& frontier,
     std::vector<RelativeWayPoint>* way_points, bool* frontier_is_observable) {
   CHECK_NOTNULL(way_points);
 
+  // Search the skeleton vertices from which the frontier can be observed.
+  std::vector<GlobalVertexId> end_vertex_candidates;
+  const bool is_observable =
+      searchFrontierExitVertices(frontier, &end_vertex_candidates);
+  if (frontier_is_observable != nullptr) {
+    *frontier_is_observable = is_observable;
+  }
+  if (!is_observable) {
+    return false;
+  }
+
+  // Plan path along the skeleton
+  std::vector<GlobalVertexId> vertex_path;
+  if (!skeleton_a_star_.getPathBetweenVertices(
+          start_vertex_candidates, end_vertex_candidates, start_point,
+          frontier.centroid, &vertex_path)) {
+    LOG(INFO) << "Could not find global path from start point ("
+              << start_point.transpose() << ") to frontier with centroid ("
+              << frontier.centroid.transpose() << ")";
+    return false;
+  }
+  convertToFrontierPath(start_point, vertex_path, frontier.centroid,
+                        way_points);
+  return true;
+}
+
+bool SkeletonPlanner::computePathsToAllFrontiers(
+    const Point& start_point,
+    const std::vector<GlobalVertexId>& start_vertex_candidates,
+    const std::chrono::high_resolution_clock::time_point& t_start,
+    int* unobservable_frontier_counter) {
+  CHECK_NOTNULL(unobservable_frontier_counter);
+
+  // Find the exit vertices of all frontiers.
+  // NOTE: Since all paths are found at once, the frontiers can not be pruned
+  //       by their euclidean distance.
+  std::vector<SkeletonAStar::Goal> goals;
+  std::vector<FrontierSearchData*> goal_frontiers;
+  bool time_exceeded = false;
+  for (FrontierSearchData& frontier : frontier_data_) {
+    frontier.path_distance = std::numeric_limits<FloatingPoint>::max();
+    if (!time_exceeded &&
+        config_.max_closest_frontier_search_time_sec <
+            std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::high_resolution_clock::now() - t_start)
+                .count()) {
+      LOG_IF(INFO, config_.verbosity >= 1)
+          << "Maximum closest frontier searching time exceeded. Will "
+             "continue with the frontiers we found so far.";
+      time_exceeded = true;
+    }
+    if (time_exceeded) {
+      frontier.reachability = FrontierSearchData::kUnchecked;
+      continue;
+    }
+    SkeletonAStar::Goal goal;
+    goal.goal_point = frontier.centroid;
+    if (!searchFrontierExitVertices(frontier, &goal.exit_vertex_candidates)) {
+      ++(*unobservable_frontier_counter);
+      frontier.reachability = FrontierSearchData::kInvalidGoal;
+      continue;
+    }
+    goals.emplace_back(std::move(goal));
+    goal_frontiers.push_back(&frontier);
+  }
+  if (goals.empty()) {
+    return false;
+  }
+
+  // Search the shortest paths to all frontiers.
+  std::vector<SkeletonAStar::GoalPath> goal_paths;
+  skeleton_a_star_.getPathsToGoals(start_vertex_candidates, start_point,
+                                   goals, &goal_paths);
+  const FloatingPoint start_offset =
+      (start_point - comm_->currentPose().position).norm();
+  int closest_goal_index = -1;
+  for (size_t i = 0u; i < goals.size(); ++i) {
+    FrontierSearchData& frontier = *goal_frontiers[i];
+    if (!goal_paths[i].is_reachable) {
+      frontier.reachability = FrontierSearchData::kUnreachable;
+      continue;
+    }
+    frontier.reachability = FrontierSearchData::kReachable;
+    frontier.path_distance = start_offset + goal_paths[i].path_length;
+    if (closest_goal_index < 0 ||
+        frontier.path_distance <
+            goal_frontiers[closest_goal_index]->path_distance) {
+      closest_goal_index = i;
+    }
+  }
+  if (closest_goal_index < 0) {
+    return false;
+  }
+
+  // Only the path to the closest frontier is converted to waypoints.
+  FrontierSearchData& closest_frontier = *goal_frontiers[closest_goal_index];
+  convertToFrontierPath(start_point, goal_paths[closest_goal_index].vertex_path,
+                        closest_frontier.centroid,
+                        &closest_frontier.way_points);
+  return true;
+}
+
+bool SkeletonPlanner::searchFrontierExitVertices(
+    const FrontierSearchData& frontier,
+    std::vector<GlobalVertexId>* end_vertex_candidates) {
+  CHECK_NOTNULL(end_vertex_candidates);
+  CHECK_NOTNULL(frontier.frontier_points);
+
   // Search the N skeleton vertices that are closest to the frontier centroid,
   // and from which at least M frontier points can be observed.
-  std::vector<GlobalVertexId> end_vertex_candidates =
+  *end_vertex_candidates =
       skeleton_a_star_.searchClosestReachableSkeletonVertices(
-          frontier_centroid,
+          frontier.centroid,
           skeleton_a_star_.getConfig().max_num_end_vertex_candidates,
-          [&](const Point& point, const Point& skeleton_vertex_point) {
-            int num_visible_frontier_points = 0;
-            for (const Point& frontier_point : frontier_points) {
-              if (isFrontierPointObservableFromPosition(
-                      frontier_point, skeleton_vertex_point)) {
-                if (SubmapFrontierEvaluator::config_
-                        .min_num_visible_frontier_points <
-                    ++num_visible_frontier_points) {
-                  return true;
-                }
-              }
+          [&](const Point& point, const GlobalVertexId& skeleton_vertex_id,
+              const Point& skeleton_vertex_point) {
+            if (!config_.cache_frontier_observability ||
+                frontier.cluster_id < 0) {
+              return isFrontierObservableFromPosition(frontier,
+                                                      skeleton_vertex_point);
+            }
+            auto it = frontier_observability_cache_.find(
+                {skeleton_vertex_id, frontier.cluster_id});
+            if (it == frontier_observability_cache_.end()) {
+              it = frontier_observability_cache_
+                       .emplace(VertexAndClusterId(skeleton_vertex_id,
+                                                   frontier.cluster_id),
+                                isFrontierObservableFromPosition(
+                                    frontier, skeleton_vertex_point))
+                       .first;
             }
-            return false;
+            return it->second;
           });
-  if (end_vertex_candidates.empty()) {
+  if (end_vertex_candidates->empty()) {
     LOG(INFO) << "Could not find any skeleton vertices from which the frontier "
                  "with centroid ("
-              << frontier_centroid.transpose() << ") can be observed.";
-    if (frontier_is_observable != nullptr) {
-      *frontier_is_observable = false;
-    }
+              << frontier.centroid.transpose() << ") can be observed.";
     return false;
-  } else {
-    if (frontier_is_observable != nullptr) {
-      *frontier_is_observable = true;
-    }
   }
+  return true;
+}
 
-  // Plan path along the skeleton
-  std::vector<GlobalVertexId> vertex_path;
-  if (!skeleton_a_star_.getPathBetweenVertices(
-          start_vertex_candidates, end_vertex_candidates, start_point,
-          frontier_centroid, &vertex_path)) {
-    LOG(INFO) << "Could not find global path from start point ("
-              << start_point.transpose() << ") to frontier with centroid ("
-              << frontier_centroid.transpose() << ")";
-    return false;
+void SkeletonPlanner::updateFrontierObservabilityCache() {
+  // The occlusions depend on all submaps, so the cache is invalidated as soon
+  // as any submap is added or moved.
+  if (frontier_observability_cache_version_ !=
+      skeleton_a_star_.getLinkLayerVersion()) {
+    frontier_observability_cache_.clear();
+    frontier_observability_cache_version_ =
+        skeleton_a_star_.getLinkLayerVersion();
+    return;
+  }
+
+  // Drop the entries of frontiers that no longer exist. Changed frontiers get
+  // new cluster ids, so the remaining entries are still valid.
+  std::unordered_set<int> active_cluster_ids;
+  for (const FrontierSearchData& frontier : frontier_data_) {
+    active_cluster_ids.insert(frontier.cluster_id);
   }
+  for (auto it = frontier_observability_cache_.begin();
+       it != frontier_observability_cache_.end();) {
+    if (active_cluster_ids.count(it->first.second)) {
+      ++it;
+    } else {
+      it = frontier_observability_cache_.erase(it);
+    }
+  }
+}
+
+void SkeletonPlanner::convertToFrontierPath(
+    const Point& start_point, const std::vector<GlobalVertexId>& vertex_path,
+    const Point& frontier_centroid, std::vector<RelativeWayPoint>* way_points) {
+  CHECK_NOTNULL(way_points);
 
   // Convert the path from vertex IDs to waypoints
   skeleton_a_star_.convertVertexToWaypointPath(vertex_path, frontier_centroid,
@@ -726,25 +883,63 @@ bool SkeletonPlanner::computePathToFrontier(
     way_points->emplace_back(RelativeWayPoint(last_vertex_submap_ptr,
                                               t_submap_last_traversable_point));
   }
-
-  return true;
 }
 
-bool SkeletonPlanner::isFrontierPointObservableFromPosition(
-    const Point& frontier_point, const Point& skeleton_vertex_point) {
-  // Check if the frontier point is within the LiDAR's FoV.
-  const FloatingPoint vertical_offset =
-      frontier_point.z() - skeleton_vertex_point.z();
-  const FloatingPoint horizontal_offset =
-      (frontier_point - skeleton_vertex_point).head<2>().norm();
-  if (config_.sensor_vertical_fov_rad / 2.f <
-      std::abs(std::atan2(vertical_offset, horizontal_offset))) {
-    return false;
+bool SkeletonPlanner::isFrontierObservableFromPosition(
+    const FrontierSearchData& frontier, const Point& skeleton_vertex_point) {
+  CHECK_NOTNULL(frontier.frontier_points);
+  const std::vector<Point>* checked_points = frontier.frontier_points;
+  FloatingPoint min_num_visible_frontier_points =
+      SubmapFrontierEvaluator::config_.min_num_visible_frontier_points;
+  if (config_.use_representative_frontier_points &&
+      frontier.representative_points &&
+      !frontier.representative_points->empty() &&
+      frontier.representative_points->size() <
+          frontier.frontier_points->size()) {
+    // Require the same fraction of the subsampled points to be visible.
+    min_num_visible_frontier_points *=
+        static_cast<FloatingPoint>(frontier.representative_points->size()) /
+        static_cast<FloatingPoint>(frontier.frontier_points->size());
+    checked_points = frontier.representative_points;
+  }
+  const std::vector<Point>& frontier_points = *checked_points;
+
+  // Check which frontier points are within the LiDAR's FoV first, since this
+  // is cheap compared to the occlusion checks.
+  std::vector<std::pair<FloatingPoint, const Point*>> points_in_fov;
+  points_in_fov.reserve(frontier_points.size());
+  for (const Point& frontier_point : frontier_points) {
+    const Point offset = frontier_point - skeleton_vertex_point;
+    const FloatingPoint horizontal_offset = offset.head<2>().norm();
+    if (std::abs(std::atan2(offset.z(), horizontal_offset)) <=
+        config_.sensor_vertical_fov_rad / 2.f) {
+      points_in_fov.emplace_back(offset.squaredNorm(), &frontier_point);
+    }
   }
 
-  // Check for occlusions.
-  return !comm_->map()->lineIntersectsSurfaceInGlobalMap(skeleton_vertex_point,
-                                                         frontier_point);
+  // Check for occlusions, starting with the closest points since their rays
+  // are the cheapest to check. Stop as soon as the result is determined.
+  std::sort(points_in_fov.begin(), points_in_fov.end(),
+            [](const std::pair<FloatingPoint, const Point*>& lhs,
+               const std::pair<FloatingPoint, const Point*>& rhs) {
+              return lhs.first < rhs.first;
+            });
+  int num_visible_frontier_points = 0;
+  int num_unchecked_frontier_points = points_in_fov.size();
+  for (const auto& distance_point_pair : points_in_fov) {
+    if (num_visible_frontier_points + num_unchecked_frontier_points <=
+        min_num_visible_frontier_points) {
+      return false;
+    }
+    --num_unchecked_frontier_points;
+    if (!comm_->map()->lineIntersectsSurfaceInGlobalMap(
+            skeleton_vertex_point, *distance_point_pair.second)) {
+      if (min_num_visible_frontier_points < ++num_visible_frontier_points) {
+        return true;
+      }
+    }
+  }
+  return false;
 }
 
 }  // namespace glocal_exploration
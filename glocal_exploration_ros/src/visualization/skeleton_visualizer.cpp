@@ -5,12 +5,14 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <utility>
 
+#include <eigen_conversions/eigen_msg.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <voxblox/utils/color_maps.h>
-#include <voxblox_skeleton/ros/skeleton_vis.h>
+#include <voxblox_ros/conversions.h>
 
 namespace glocal_exploration {
 
@@ -435,32 +437,51 @@ void SkeletonVisualizer::visualizeSkeletonSubmaps() {
   visualization_msgs::MarkerArray marker_array;
   for (const auto& submap_ptr :
        planner_->getSkeletonSubmapCollection().getSubmapConstPtrs()) {
-    // Generate the graph markers
-    visualization_msgs::MarkerArray submap_marker_array;
-    std::string submap_frame_id = submap_ptr->getFrameId();
-    voxblox::visualizeSkeletonGraph(submap_ptr->getSkeletonGraph(),
-                                    submap_frame_id, &submap_marker_array);
-
-    // Namespace and recolor by ID
+    // Setup the vertex and edge markers, colored by submap ID.
+    const std::string submap_frame_id = submap_ptr->getFrameId();
     const voxblox::Color submap_color =
         submap_id_color_map.colorLookup(submap_ptr->getId());
     const voxblox::Color submap_vertex_color = voxblox::Color::blendTwoColors(
         submap_color, 0.7f, voxblox::Color::Black(), 0.3f);
-    for (auto& marker : submap_marker_array.markers) {
-      if (marker.ns == "vertices") {
-        voxblox::colorVoxbloxToMsg(submap_vertex_color, &marker.color);
-        marker.colors.clear();
-      } else if (marker.ns == "edges") {
-        voxblox::colorVoxbloxToMsg(submap_color, &marker.color);
+    visualization_msgs::Marker vertex_marker;
+    vertex_marker.header.frame_id = submap_frame_id;
+    vertex_marker.header.stamp = ros::Time();
+    vertex_marker.ns = submap_frame_id + "_vertices";
+    vertex_marker.type = visualization_msgs::Marker::SPHERE_LIST;
+    vertex_marker.action = visualization_msgs::Marker::ADD;
+    vertex_marker.pose.orientation.w = 1.0;
+    vertex_marker.scale.x = 0.2;
+    vertex_marker.scale.y = 0.2;
+    vertex_marker.scale.z = 0.2;
+    voxblox::colorVoxbloxToMsg(submap_vertex_color, &vertex_marker.color);
+    visualization_msgs::Marker edge_marker = vertex_marker;
+    edge_marker.ns = submap_frame_id + "_edges";
+    edge_marker.type = visualization_msgs::Marker::LINE_LIST;
+    edge_marker.scale.x = 0.05;
+    voxblox::colorVoxbloxToMsg(submap_color, &edge_marker.color);
+
+    // Add the vertices and each edge once.
+    for (VertexIdElement vertex_id = 0;
+         vertex_id < submap_ptr->getNumVertices(); ++vertex_id) {
+      geometry_msgs::Point vertex_position_msg;
+      tf::pointEigenToMsg(submap_ptr->getVertexPoint(vertex_id).cast<double>(),
+                          vertex_position_msg);
+      vertex_marker.points.push_back(vertex_position_msg);
+      for (const SkeletonSubmap::Neighbor& neighbor :
+           submap_ptr->getNeighbors(vertex_id)) {
+        if (neighbor.vertex_id <= vertex_id) {
+          continue;
+        }
+        geometry_msgs::Point neighbor_position_msg;
+        tf::pointEigenToMsg(
+            submap_ptr->getVertexPoint(neighbor.vertex_id).cast<double>(),
+            neighbor_position_msg);
+        edge_marker.points.push_back(vertex_position_msg);
+        edge_marker.points.push_back(neighbor_position_msg);
       }
-      marker.ns = submap_frame_id + "_" + marker.ns;
     }
-
-    // Concatenate
-    marker_array.markers.insert(
-        marker_array.markers.end(),
-        std::make_move_iterator(submap_marker_array.markers.begin()),
-        std::make_move_iterator(submap_marker_array.markers.end()));
+    marker_array.markers.push_back(std::move(vertex_marker));
+    marker_array.markers.push_back(std::move(edge_marker));
   }
   skeleton_submaps_pub_.publish(marker_array);
 }
@@ -482,9 +503,8 @@ bool SkeletonVisualizer::getVertexPositionMsg(
       planner_->getSkeletonSubmapCollection().getSubmapConstPtrById(
           global_vertex_id.submap_id);
   if (submap_ptr) {
-    const Point t_submap_vertex = submap_ptr->getSkeletonGraph()
-                                      .getVertex(global_vertex_id.vertex_id)
-                                      .point;
+    const Point t_submap_vertex =
+        submap_ptr->getVertexPoint(global_vertex_id.vertex_id);
     const Point t_odom_vertex = submap_ptr->getPose() * t_submap_vertex;
     tf::pointEigenToMsg(t_odom_vertex.cast<double>(), *position_msg);
     return true;